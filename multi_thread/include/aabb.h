@@ -4,6 +4,15 @@
 
 #include "interval.h"
 #include "ray.h"
+#include "ray_packet.h"
+
+#include <algorithm>
+#include <initializer_list>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+    #include <immintrin.h>
+    #define AABB_AVX __attribute__((target("avx")))
+#endif
 
 class aabb {
     public:
@@ -41,29 +50,56 @@ class aabb {
         }
 
         bool hit(const ray& r, interval ray_t) const {
+            // The ray's sign bits pick each axis' near and far slab up front, so the slab test
+            // needs no division and no branch. A ray lying in a slab plane makes 0 * inf = NaN,
+            // which min_of/max_of drop, so it never narrows the interval.
             const point3& ray_orig = r.origin();
-            const vec3&   ray_dir  = r.direction();
+            const vec3&   inv_dir  = r.inv_direction();
 
             for (int axis = 0; axis < 3; axis++) {
                 const interval& ax = axis_interval(axis);
-                const double adinv = 1.0 / ray_dir[axis];
+                auto near_slab = r.sign(axis) ? ax.max : ax.min;
+                auto far_slab  = r.sign(axis) ? ax.min : ax.max;
 
-                auto t0 = (ax.min - ray_orig[axis]) * adinv;
-                auto t1 = (ax.max - ray_orig[axis]) * adinv;
+                ray_t.min = max_of(ray_t.min, (near_slab - ray_orig[axis]) * inv_dir[axis]);
+                ray_t.max = min_of(ray_t.max, (far_slab  - ray_orig[axis]) * inv_dir[axis]);
+            }
 
-                if (t0 < t1) {
-                    if (t0 > ray_t.min) ray_t.min = t0;
-                    if (t1 < ray_t.max) ray_t.max = t1;
-                } else {
-                    if (t1 > ray_t.min) ray_t.min = t1;
-                    if (t0 < ray_t.max) ray_t.max = t0;
-                }
+            return ray_t.min < ray_t.max;
+        }
+        unsigned hit_packet(const ray_packet& p, unsigned mask) const {
+            // The slab test for every lane of the packet at once, without branches. Returns the
+            // lanes of `mask` whose current interval overlaps the box. A NaN slab distance (a
+            // ray on a slab plane) loses every comparison, so it never narrows the interval.
+            // On x86-64 the lanes go four to an AVX register where the processor has AVX, and
+            // two to an SSE2 register otherwise; elsewhere they're tested one at a time.
+#if defined(AABB_AVX)
+            if (has_avx())
+                return hit_packet_avx(p) & mask;
+            return hit_packet_sse2(p) & mask;
+#else
+            unsigned result = 0;
 
-                if (ray_t.max <= ray_t.min)
-                    return false;
+            for (int i = 0; i < ray_packet::width; i++) {
+                auto tx0 = (x.min - p.ox[i]) * p.inv_dx[i];
+                auto tx1 = (x.max - p.ox[i]) * p.inv_dx[i];
+                auto ty0 = (y.min - p.oy[i]) * p.inv_dy[i];
+                auto ty1 = (y.max - p.oy[i]) * p.inv_dy[i];
+                auto tz0 = (z.min - p.oz[i]) * p.inv_dz[i];
+                auto tz1 = (z.max - p.oz[i]) * p.inv_dz[i];
+
+                auto t_enter = max_of(p.t_min[i], max_of(min_of(tx0, tx1),
+                                      max_of(min_of(ty0, ty1), min_of(tz0, tz1))));
+                auto t_exit  = min_of(p.t_max[i], min_of(max_of(tx0, tx1),
+                                      min_of(max_of(ty0, ty1), max_of(tz0, tz1))));
+
+                result |= unsigned(t_enter < t_exit) << i;
             }
-            return true;
+
+            return result & mask;
+#endif
         }
+
     int longest_axis() const {
         // Returns the index of the longest axis of the bounding box.
 
@@ -76,6 +112,83 @@ class aabb {
     static const aabb empty, universe;
 
     private:
+        // Keep the left operand unless the right one is strictly better, so NaNs on the right
+        // are dropped.
+        static double min_of(double a, double b) { return b < a ? b : a; }
+        static double max_of(double a, double b) { return b > a ? b : a; }
+
+#if defined(AABB_AVX)
+        static bool has_avx() {
+            static const bool supported = __builtin_cpu_supports("avx");
+            return supported;
+        }
+
+        // minpd and maxpd return their second operand when either is NaN, so min_of(a, b) is
+        // min(b, a) and max_of(a, b) is max(b, a), and the kernels below give the same lanes as
+        // the scalar test, NaNs included.
+        AABB_AVX unsigned hit_packet_avx(const ray_packet& p) const {
+            unsigned result = 0;
+
+            for (int i = 0; i < ray_packet::width; i += 4) {
+                auto ix = _mm256_loadu_pd(p.inv_dx + i);
+                auto iy = _mm256_loadu_pd(p.inv_dy + i);
+                auto iz = _mm256_loadu_pd(p.inv_dz + i);
+                auto ox = _mm256_loadu_pd(p.ox + i);
+                auto oy = _mm256_loadu_pd(p.oy + i);
+                auto oz = _mm256_loadu_pd(p.oz + i);
+
+                auto tx0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(x.min), ox), ix);
+                auto tx1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(x.max), ox), ix);
+                auto ty0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(y.min), oy), iy);
+                auto ty1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(y.max), oy), iy);
+                auto tz0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(z.min), oz), iz);
+                auto tz1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(z.max), oz), iz);
+
+                auto near = _mm256_max_pd(_mm256_max_pd(_mm256_min_pd(tz1, tz0), _mm256_min_pd(ty1, ty0)),
+                                          _mm256_min_pd(tx1, tx0));
+                auto far  = _mm256_min_pd(_mm256_min_pd(_mm256_max_pd(tz1, tz0), _mm256_max_pd(ty1, ty0)),
+                                          _mm256_max_pd(tx1, tx0));
+                auto t_enter = _mm256_max_pd(near, _mm256_loadu_pd(p.t_min + i));
+                auto t_exit  = _mm256_min_pd(far,  _mm256_loadu_pd(p.t_max + i));
+
+                result |= unsigned(_mm256_movemask_pd(_mm256_cmp_pd(t_enter, t_exit, _CMP_LT_OQ))) << i;
+            }
+
+            return result;
+        }
+
+        unsigned hit_packet_sse2(const ray_packet& p) const {
+            unsigned result = 0;
+
+            for (int i = 0; i < ray_packet::width; i += 2) {
+                auto ix = _mm_loadu_pd(p.inv_dx + i);
+                auto iy = _mm_loadu_pd(p.inv_dy + i);
+                auto iz = _mm_loadu_pd(p.inv_dz + i);
+                auto ox = _mm_loadu_pd(p.ox + i);
+                auto oy = _mm_loadu_pd(p.oy + i);
+                auto oz = _mm_loadu_pd(p.oz + i);
+
+                auto tx0 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(x.min), ox), ix);
+                auto tx1 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(x.max), ox), ix);
+                auto ty0 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(y.min), oy), iy);
+                auto ty1 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(y.max), oy), iy);
+                auto tz0 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(z.min), oz), iz);
+                auto tz1 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(z.max), oz), iz);
+
+                auto near = _mm_max_pd(_mm_max_pd(_mm_min_pd(tz1, tz0), _mm_min_pd(ty1, ty0)),
+                                       _mm_min_pd(tx1, tx0));
+                auto far  = _mm_min_pd(_mm_min_pd(_mm_max_pd(tz1, tz0), _mm_max_pd(ty1, ty0)),
+                                       _mm_max_pd(tx1, tx0));
+                auto t_enter = _mm_max_pd(near, _mm_loadu_pd(p.t_min + i));
+                auto t_exit  = _mm_min_pd(far,  _mm_loadu_pd(p.t_max + i));
+
+                result |= unsigned(_mm_movemask_pd(_mm_cmplt_pd(t_enter, t_exit))) << i;
+            }
+
+            return result;
+        }
+#endif
+
         void pad_to_minimums() {
             // Adjust the AABB so that no side is narrower than some delta, padding if necessary.
 
@@ -100,6 +213,69 @@ aabb operator+(const vec3& offset, const aabb& bbox) {
 }
 
 
+inline aabb intersect(const aabb& a, const aabb& b) {
+    // The box common to a and b, or aabb::empty if they don't overlap.
+    interval axes[3];
+    for (int n = 0; n < 3; n++) {
+        const auto& ia = a.axis_interval(n);
+        const auto& ib = b.axis_interval(n);
+        axes[n] = interval(std::fmax(ia.min, ib.min), std::fmin(ia.max, ib.max));
+        if (axes[n].min > axes[n].max)
+            return aabb::empty;
+    }
+    return aabb(axes[0], axes[1], axes[2]);
+}
+
+inline aabb clipped_polygon_box(std::initializer_list<point3> vertices, const aabb& clip) {
+    // Bounds of the part of a convex planar polygon (of up to four vertices) inside `clip`,
+    // found by clipping it against each of the box's six planes in turn (Sutherland-Hodgman).
+    // Each plane adds at most one vertex, so ten slots are always enough.
+    point3 polygon[10], kept[10];
+    int count = 0;
+    for (const auto& v : vertices)
+        polygon[count++] = v;
+
+    for (int axis = 0; axis < 3 && count > 0; axis++) {
+        for (int side = 0; side < 2 && count > 0; side++) {
+            const auto& slab = clip.axis_interval(axis);
+            auto inside = [&](const point3& p) {
+                return side == 0 ? p[axis] >= slab.min : p[axis] <= slab.max;
+            };
+            double plane = side == 0 ? slab.min : slab.max;
+
+            int kept_count = 0;
+            for (int i = 0; i < count; i++) {
+                const auto& a = polygon[i];
+                const auto& b = polygon[(i + 1) % count];
+                if (inside(a))
+                    kept[kept_count++] = a;
+                if (inside(a) != inside(b)) {
+                    auto t = (plane - a[axis]) / (b[axis] - a[axis]);
+                    auto p = a + t * (b - a);
+                    p[axis] = plane;
+                    kept[kept_count++] = p;
+                }
+            }
+
+            std::copy(kept, kept + kept_count, polygon);
+            count = kept_count;
+        }
+    }
+
+    if (count == 0)
+        return aabb::empty;
+
+    point3 lo = polygon[0], hi = polygon[0];
+    for (int i = 1; i < count; i++) {
+        for (int n = 0; n < 3; n++) {
+            lo[n] = std::fmin(lo[n], polygon[i][n]);
+            hi[n] = std::fmax(hi[n], polygon[i][n]);
+        }
+    }
+    return aabb(lo, hi);
+}
+
+
 
 
 #endif
@@ -0,0 +1,170 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "camera.h"
+#include "dynamic_bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "light_tree.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// A value that changes over time: keys at given times, linearly interpolated between them and
+// held constant before the first and after the last.
+template <typename T>
+class keyframe_track {
+  public:
+    keyframe_track& add(double time, const T& value) {
+        auto at = std::upper_bound(keys.begin(), keys.end(), time,
+                                   [](double t, const auto& key) { return t < key.first; });
+        keys.insert(at, {time, value});
+        return *this;
+    }
+
+    bool empty() const { return keys.empty(); }
+
+    T at(double time) const {
+        if (time <= keys.front().first) return keys.front().second;
+        if (time >= keys.back().first) return keys.back().second;
+
+        auto next = std::upper_bound(keys.begin(), keys.end(), time,
+                                     [](double t, const auto& key) { return t < key.first; });
+        auto prev = next - 1;
+        auto f = (time - prev->first) / (next->first - prev->first);
+        return (1 - f) * prev->second + f * next->second;
+    }
+
+  private:
+    std::vector<std::pair<double, T>> keys;
+};
+
+
+// Camera parameters that follow keyframes; an empty track leaves the base camera's value.
+class camera_animation {
+  public:
+    keyframe_track<point3> lookfrom;
+    keyframe_track<point3> lookat;
+    keyframe_track<double> vfov;
+    keyframe_track<double> focus_dist;
+
+    void apply(camera& cam, double time) const {
+        if (!lookfrom.empty())   cam.lookfrom = lookfrom.at(time);
+        if (!lookat.empty())     cam.lookat = lookat.at(time);
+        if (!vfov.empty())       cam.vfov = vfov.at(time);
+        if (!focus_dist.empty()) cam.focus_dist = focus_dist.at(time);
+    }
+};
+
+
+// An asset placed by keyframed transforms. The asset itself is loaded once; each frame only
+// wraps it in a fresh rotate_y and translate.
+class animated_object {
+  public:
+    shared_ptr<hittable> asset;
+    keyframe_track<double> rotation_y;  // Degrees, applied first
+    keyframe_track<vec3> offset;
+
+    animated_object(shared_ptr<hittable> asset) : asset(asset) {}
+
+    shared_ptr<hittable> at(double time) const {
+        auto object = asset;
+        if (!rotation_y.empty())
+            object = make_shared<rotate_y>(object, rotation_y.at(time));
+        if (!offset.empty())
+            object = make_shared<translate>(object, offset.at(time));
+        return object;
+    }
+};
+
+
+// A sequence of frames over one set of loaded assets. Each frame goes to its own numbered file
+// (output_pattern is a printf pattern given the frame number).
+//
+// Frames alternate between two dynamic_bvh worlds. While frame N renders from one, frame N+1 is
+// prepared on another thread in the other: its objects are re-placed, its tree refitted and
+// its camera set up. Lights don't move.
+class animation {
+  public:
+    hittable_list world;   // Everything that doesn't move
+    hittable_list lights;
+    camera cam;            // Base camera settings, overridden by camera_path
+    camera_animation camera_path;
+    std::vector<animated_object> objects;
+
+    int first_frame = 0;
+    int last_frame = 0;
+    double frames_per_second = 24;
+    std::string output_pattern = "frame_%04d.ppm";
+
+    std::vector<render_stats> render(int num_threads) {
+        trace_scope trace("animation", "render");
+
+        frame_state states[2];
+        std::vector<render_stats> stats;
+        auto light_choice = make_light_sampler(lights);
+
+        auto prepare = [this](frame_state& state, int frame) {
+            trace_scope trace("frame prep", "build", frame);
+            auto time = (frame - first_frame) / frames_per_second;
+
+            if (!state.world) {
+                // First use: the static objects come first, so animated object k is handle
+                // static_count + k.
+                hittable_list all = world;
+                for (const auto& object : objects)
+                    all.add(object.at(time));
+                state.world = std::make_unique<dynamic_bvh>(all);
+            } else {
+                auto static_count = int(world.objects.size());
+                for (size_t k = 0; k < objects.size(); k++)
+                    state.world->set(static_count + int(k), objects[k].at(time));
+                state.world->update();
+            }
+
+            state.cam = cam;
+            camera_path.apply(state.cam, time);
+            state.cam.output_file = frame_filename(frame);
+        };
+
+        auto next = std::async(std::launch::async, prepare, std::ref(states[0]), first_frame);
+
+        for (int frame = first_frame; frame <= last_frame; frame++) {
+            next.get();
+            auto& current = states[(frame - first_frame) % 2];
+
+            if (frame < last_frame) {
+                auto& following = states[(frame + 1 - first_frame) % 2];
+                next = std::async(std::launch::async, prepare, std::ref(following), frame + 1);
+            }
+
+            trace_scope frame_trace("frame", "render", frame);
+            std::clog << "\nFrame " << frame << " -> " << current.cam.output_file << "\n";
+            stats.push_back(current.cam.render(*current.world, num_threads, *light_choice));
+        }
+
+        return stats;
+    }
+
+  private:
+    class frame_state {
+      public:
+        std::unique_ptr<dynamic_bvh> world;
+        camera cam;
+    };
+
+    std::string frame_filename(int frame) const {
+        char name[512];
+        std::snprintf(name, sizeof(name), output_pattern.c_str(), frame);
+        return name;
+    }
+};
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef BAKED_TEXTURE_H
+#define BAKED_TEXTURE_H
+
+#include "aabb.h"
+#include "color.h"
+#include "texture.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+
+// A procedural texture sampled once onto a grid and interpolated from then on, for textures
+// that cost much more to evaluate than to look up: noise's seven octaves of turbulence, or
+// checkers nested through several levels of children.
+//
+// A surface bake samples the texture over one object's (u,v) square, at the points its
+// surface_point gives, and then stands in for the texture on that object only. A solid bake
+// samples it over a box, for textures that vary with p alone (they're given (u,v) = (0,0)), and
+// stands in anywhere in the box; points outside are clamped to it. Samples sit on the grid's
+// corners, so lookups interpolate bilinearly or trilinearly between them.
+//
+// Interpolation smooths away what the grid can't resolve, such as checker edges and the finest
+// noise octaves, so each bake measures what it lost: the texture and the bake are compared at a
+// few thousand random points of the domain, and the RMS and largest channel differences are
+// kept in error() and logged.
+class baked_texture : public texture {
+  public:
+    class bake_error {
+      public:
+        double rms = 0;
+        double max = 0;
+        int probes = 0;
+    };
+
+    // A width x height grid over (u,v), sampled at surface(u,v).
+    baked_texture(shared_ptr<texture> source, int width, int height,
+                  std::function<point3(double, double)> surface)
+      : nx(std::max(width, 2)), ny(std::max(height, 2)), nz(1)
+    {
+        bake([&](int i, int j, int) {
+            auto u = double(i) / (nx - 1);
+            auto v = double(j) / (ny - 1);
+            return source->value(u, v, surface(u, v));
+        });
+        measure([&](std::mt19937& rng, color& expected, color& baked) {
+            std::uniform_real_distribution<double> unit(0, 1);
+            auto u = unit(rng), v = unit(rng);
+            auto p = surface(u, v);
+            expected = source->value(u, v, p);
+            baked = value(u, v, p);
+        });
+    }
+
+    // A grid over box with `resolution` cells along its longest side and cells about as wide
+    // along the others. A box with no size at all, a point or an empty box, gets one cell
+    // along each axis.
+    baked_texture(shared_ptr<texture> source, const aabb& box, int resolution) : box(box) {
+        solid = true;
+        auto longest = std::fmax(box.x.size(), std::fmax(box.y.size(), box.z.size()));
+        auto cells = [&](const interval& extent) {
+            if (!(longest > 0))
+                return 1;
+            return std::max(1, int(std::ceil(resolution * extent.size() / longest)));
+        };
+        nx = cells(box.x) + 1;
+        ny = cells(box.y) + 1;
+        nz = cells(box.z) + 1;
+
+        bake([&](int i, int j, int k) {
+            return source->value(0, 0, grid_point(i, j, k));
+        });
+        measure([&](std::mt19937& rng, color& expected, color& baked) {
+            std::uniform_real_distribution<double> unit(0, 1);
+            point3 p(box.x.min + unit(rng) * box.x.size(),
+                     box.y.min + unit(rng) * box.y.size(),
+                     box.z.min + unit(rng) * box.z.size());
+            expected = source->value(0, 0, p);
+            baked = value(0, 0, p);
+        });
+    }
+
+    color value(double u, double v, const point3& p) const override {
+        if (!solid) {
+            auto unit = interval(0,1);
+            return interpolate(unit.clamp(u) * (nx - 1), unit.clamp(v) * (ny - 1), 0);
+        }
+
+        return interpolate(grid_coordinate(p.x(), box.x, nx),
+                           grid_coordinate(p.y(), box.y, ny),
+                           grid_coordinate(p.z(), box.z, nz));
+    }
+
+    const bake_error& error() const { return measured; }
+
+    size_t memory_bytes() const { return samples.size() * sizeof(float); }
+
+  private:
+    bool solid = false;
+    aabb box;                    // For a solid bake
+    int nx, ny, nz;              // Samples along each axis; nz is 1 for a surface bake
+    std::vector<float> samples;  // RGB, x fastest, then y, then z
+    bake_error measured;         // Of the bake against its source
+
+    point3 grid_point(int i, int j, int k) const {
+        return point3(box.x.min + box.x.size() * i / (nx - 1),
+                      box.y.min + box.y.size() * j / (ny - 1),
+                      box.z.min + box.z.size() * k / (nz - 1));
+    }
+
+    static double grid_coordinate(double x, const interval& extent, int n) {
+        auto t = extent.size() > 0 ? (x - extent.min) / extent.size() : 0.0;
+        return interval(0,1).clamp(t) * (n - 1);
+    }
+
+    template <typename sampler>
+    void bake(const sampler& sample) {
+        trace_scope trace("texture bake", "load");
+        samples.resize(size_t(nx) * ny * nz * 3);
+
+        // Slices of the grid go to as many threads as there are cores. Textures are only read
+        // while rendering, so evaluating one from several threads is safe.
+        auto slices = ny * nz;
+        auto threads = std::max(1, std::min(int(std::thread::hardware_concurrency()), slices));
+        std::vector<std::future<void>> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.push_back(std::async(std::launch::async, [&, t] {
+                for (int slice = t; slice < slices; slice += threads) {
+                    int j = slice % ny, k = slice / ny;
+                    for (int i = 0; i < nx; i++) {
+                        auto c = sample(i, j, k);
+                        auto* s = &samples[((size_t(k) * ny + j) * nx + i) * 3];
+                        s[0] = float(c.x());
+                        s[1] = float(c.y());
+                        s[2] = float(c.z());
+                    }
+                }
+            }));
+        }
+        for (auto& w : workers)
+            w.get();
+    }
+
+    template <typename prober>
+    void measure(const prober& probe) {
+        // A generator of its own, so the report is repeatable and the scene's random sequence
+        // is left alone.
+        const int probes = 4096;
+        std::mt19937 rng(1);
+        double sum = 0;
+        for (int n = 0; n < probes; n++) {
+            color expected, baked;
+            probe(rng, expected, baked);
+            for (int c = 0; c < 3; c++) {
+                auto d = std::fabs(expected[c] - baked[c]);
+                sum += d * d;
+                measured.max = std::fmax(measured.max, d);
+            }
+        }
+        measured.rms = std::sqrt(sum / (3.0 * probes));
+        measured.probes = probes;
+
+        std::clog << "Baked texture: " << nx << "x" << ny;
+        if (solid) std::clog << "x" << nz;
+        std::clog << " samples, " << memory_bytes() / 1e6 << " MB, error rms " << measured.rms
+                  << ", max " << measured.max << "\n";
+    }
+
+    color interpolate(double x, double y, double z) const {
+        // Coordinates are in samples, already clamped to the grid.
+        auto i0 = std::min(int(x), nx - 1), i1 = std::min(i0 + 1, nx - 1);
+        auto j0 = std::min(int(y), ny - 1), j1 = std::min(j0 + 1, ny - 1);
+        auto k0 = std::min(int(z), nz - 1), k1 = std::min(k0 + 1, nz - 1);
+        auto fx = x - i0, fy = y - j0, fz = z - k0;
+
+        auto at = [&](int i, int j, int k) {
+            const auto* s = &samples[((size_t(k) * ny + j) * nx + i) * 3];
+            return color(s[0], s[1], s[2]);
+        };
+        auto plane = [&](int k) {
+            return (1 - fy) * ((1 - fx) * at(i0, j0, k) + fx * at(i1, j0, k))
+                 +      fy  * ((1 - fx) * at(i0, j1, k) + fx * at(i1, j1, k));
+        };
+
+        auto c = plane(k0);
+        return k1 == k0 ? c : (1 - fz) * c + fz * plane(k1);
+    }
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include "aabb.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "trace.h"
 
 #include <algorithm>
 
@@ -17,7 +18,10 @@ class bvh_node : public hittable {
     }
 
     bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
-                int axis = random_int(0,2);
+        // Only the root records a trace event, spanning the whole build.
+        trace_scope trace(start == 0 && end == objects.size() ? "bvh build" : nullptr, "build");
+
+        axis = random_int(0,2);
 
         auto comparator = (axis == 0) ? box_x_compare
                         : (axis == 1) ? box_y_compare
@@ -39,9 +43,24 @@ class bvh_node : public hittable {
         }
 
         bbox = aabb(left->bounding_box(), right->bounding_box());    
+
+        left_node = dynamic_cast<const bvh_node*>(left.get());
+        right_node = dynamic_cast<const bvh_node*>(right.get());
+    }
+
+    bvh_node(shared_ptr<hittable> left, shared_ptr<hittable> right, const aabb& bbox, int axis)
+      : left(left), right(right), bbox(bbox), axis(axis)
+    {
+        // Joins two subtrees under a box the caller worked out. Builders that clip objects to
+        // parts of space (sbvh_builder) need this, since a clipped child's bounding_box() is
+        // still the unclipped one. `left` should be the child on the low side of `axis`.
+        left_node = dynamic_cast<const bvh_node*>(left.get());
+        right_node = dynamic_cast<const bvh_node*>(right.get());
     }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        RT_STAT_INC(nodes_visited);
+
         if (!bbox.hit(r, ray_t))
             return false;
 
@@ -51,12 +70,92 @@ class bvh_node : public hittable {
         return hit_left || hit_right;
     }
 
+    unsigned hit_packet(ray_packet& packet, unsigned mask, hit_record recs[]) const override {
+        // Walks the tree once for the whole packet with a single explicit stack. Each node is
+        // box-tested against every lane still in its mask, and only the lanes that hit the box
+        // go on to its children. Once a node is reached by too few lanes for the shared walk to
+        // pay off, those lanes finish that subtree as single rays.
+        const int min_coherent_lanes = 3;
+
+        // Entries are inner nodes, or leaf objects (with a null node) that are tested as soon as
+        // they are popped.
+        const bvh_node* stack_node[64];
+        const hittable* stack_leaf[64];
+        unsigned stack_mask[64];
+        int top = 0;
+        unsigned hits = 0;
+
+        auto push = [&](const hittable* object, const bvh_node* node, unsigned lanes) {
+            if (top == 64) {
+                hits |= object->hit_packet(packet, lanes, recs);
+                return;
+            }
+            stack_leaf[top] = object;
+            stack_node[top] = node;
+            stack_mask[top++] = lanes;
+        };
+
+        push(this, this, mask);
+
+        while (top > 0) {
+            top--;
+            const bvh_node* node = stack_node[top];
+            if (!node) {
+                hits |= stack_leaf[top]->hit_packet(packet, stack_mask[top], recs);
+                continue;
+            }
+
+            unsigned lanes = node->bbox.hit_packet(packet, stack_mask[top]);
+            RT_STAT_INC(nodes_visited);
+
+            if (lanes == 0)
+                continue;
+
+            if (ray_packet::count(lanes) < min_coherent_lanes) {
+                for (int i = 0; i < ray_packet::width; i++) {
+                    if ((lanes & (1u << i))
+                        && node->hit(packet.get_ray(i), packet.get_interval(i), recs[i])) {
+                        packet.t_max[i] = recs[i].t;
+                        hits |= 1u << i;
+                    }
+                }
+                continue;
+            }
+
+            // Children were sorted by their minimum along the split axis, so the left one is
+            // nearer for rays heading in the positive direction. Push the far child first so
+            // the near one is visited first and shortens t_max for the other.
+            int first = __builtin_ctz(lanes);
+            bool left_first = packet_direction(packet, node->axis, first) >= 0;
+            const hittable* near = left_first ? node->left.get() : node->right.get();
+            const hittable* far = left_first ? node->right.get() : node->left.get();
+            const bvh_node* near_node = left_first ? node->left_node : node->right_node;
+            const bvh_node* far_node = left_first ? node->right_node : node->left_node;
+
+            if (far != near)
+                push(far, far_node, lanes);
+            push(near, near_node, lanes);
+        }
+
+        return hits;
+    }
+
     aabb bounding_box() const override { return bbox; }
 
 private:
     shared_ptr<hittable> left;
     shared_ptr<hittable> right;
     aabb bbox;
+    int axis;
+
+    // The children again, when they are inner nodes, so packet traversal can push them on its
+    // own stack instead of making a virtual call.
+    const bvh_node* left_node = nullptr;
+    const bvh_node* right_node = nullptr;
+
+    static double packet_direction(const ray_packet& packet, int axis, int lane) {
+        return axis == 0 ? packet.dx[lane] : axis == 1 ? packet.dy[lane] : packet.dz[lane];
+    }
 
     static bool box_compare(
         const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index
@@ -6,17 +6,45 @@
 #include "material.h"
 #include "ray.h"
 #include "color.h"
+#include "environment.h"
 #include "vec3.h"
 #include "threadpool.h"
 #include "pdf.h"
+#include "stats.h"
+#include "trace.h"
+#include "wavefront.h"
 
 
+#include <chrono>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <string>
 #include <thread>
 #include <vector>
 
 
+// Timing and ray counts gathered by one call to camera::render.
+class render_stats {
+  public:
+    double    render_seconds = 0;       // Wall time from the first task queued to the last line done
+    double    first_pixel_seconds = 0;  // Wall time until any worker finished its first pixel
+    long long rays = 0;                 // Rays traced against the world, all bounces included
+    long long paths = 0;                // Camera samples traced
+    long long nodes_visited = 0;        // BVH nodes entered (RT_STATS builds only)
+    long long primitive_tests = 0;      // Primitive intersection tests (RT_STATS builds only)
+};
+
+// Per-scanline share of render_stats, summed once all lines are done.
+class line_stats {
+  public:
+    long long rays = 0;
+    long long paths = 0;
+    long long nodes_visited = 0;
+    long long primitive_tests = 0;
+    double    first_pixel_seconds = 0;
+};
+
 class camera {
     public:
         //ratio of image width over height
@@ -29,6 +57,9 @@ class camera {
         int max_depth = 10;
         // Scene background color
         color  background;
+        // Image-based light around the scene; where set, it replaces the background color and
+        // takes a share of the light samples (see environment.h).
+        shared_ptr<environment_light> environment;
 
 
         double  vfov     = 90;
@@ -40,62 +71,136 @@ class camera {
         double focus_dist = 10;
 
 
+        // File the finished image is written to; empty skips writing it.
+        std::string output_file = "image.ppm";
+        // Nonzero seeds every scanline's generator from this value, making renders repeatable
+        // regardless of which worker picks up which line.
+        unsigned int seed = 0;
+        // Bounces before Russian roulette may end a path; max_depth or more turns it off.
+        int russian_roulette_depth = 3;
+        // Trace each scanline as one wave of paths, shaded a material at a time, instead of one
+        // path at a time (see wavefront.h).
+        bool wavefront = false;
+        // Trace primary rays in packets of neighbouring pixels (see ray_packet.h); pays off when
+        // the world is a BVH.
+        bool packets = false;
+        // Filter image textures over each sample's footprint, found by following the
+        // neighbouring pixels' rays (see ray_differential) up to the first diffuse bounce.
+        bool filter_textures = true;
+
+
         /* Public Camera Parameters Here */
-        void render(const hittable& world, int num_threads, const hittable& lights) {
+        render_stats render(const hittable& world, int num_threads, const hittable& lights) {
+            trace_scope trace("render", "render");
             initialize();
 
-            std::ofstream file("image.ppm");
+            auto start = std::chrono::steady_clock::now();
 
             std::string** output = new std::string*[image_height];  // Allocate rows
                 for (int i = 0; i < image_height; ++i) {
                 output[i] = new std::string[image_width];  // Allocate columns for each row
             }
 
-            std::vector<std::thread> threads;
+            // Each scanline writes only its own slot, so no locking is needed.
+            std::vector<line_stats> line_results(image_height);
 
+            stats_images* heat = nullptr;
+#ifdef RT_STATS
+            stats_images heat_images(image_width, image_height);
+            heat = &heat_images;
+#endif
 
-            ThreadPool pool(num_threads);
+            std::unique_ptr<environment_and_lights> with_environment;
+            if (environment)
+                with_environment = std::make_unique<environment_and_lights>(*environment, lights);
+            const hittable& light_choice = with_environment ? *with_environment : lights;
 
-            file << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+            ThreadPool pool(num_threads);
 
             for (int j = 0; j < image_height; j++) {
                 int assigned_line = j;
-                pool.enqueue(([this, &world, output, assigned_line, &lights]()
-                        { render_line(world, output, assigned_line, lights); }));
+                pool.enqueue(([this, &world, output, assigned_line, &light_choice, &line_results, start, heat]()
+                        { trace_scope trace("scanline", "render", assigned_line);
+                          line_results[assigned_line] =
+                            render_line(world, output, assigned_line, light_choice, start, heat); }));
             }
 
             pool.waitUntilDone();
 
-            for (int i = 0; i < image_height; i++)
-            {
-                for(int j = 0; j < image_width; j++)
+            render_stats stats;
+            stats.first_pixel_seconds = infinity;
+            for (const auto& line : line_results) {
+                stats.rays += line.rays;
+                stats.paths += line.paths;
+                stats.nodes_visited += line.nodes_visited;
+                stats.primitive_tests += line.primitive_tests;
+                stats.first_pixel_seconds = std::fmin(stats.first_pixel_seconds, line.first_pixel_seconds);
+            }
+            stats.render_seconds =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if (!output_file.empty()) {
+                trace_scope trace("write output", "io");
+                std::ofstream file(output_file);
+                file << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+
+                for (int i = 0; i < image_height; i++)
                 {
-                    file << output[i][j];
+                    for(int j = 0; j < image_width; j++)
+                    {
+                        file << output[i][j];
+                    }
                 }
+                file.close();
             }
 
+            for (int i = 0; i < image_height; i++)
+                delete[] output[i];
+            delete[] output;
 
             std::clog << "\nDone!\n";
-            file.close();
+
+#ifdef RT_STATS
+            heat_images.write(output_file);
+            print_stats(stats, heat_images);
+#endif
+            return stats;
         }
 
 
-        void render_line(const hittable& world, std::string **output, int j, const hittable& lights)
+        line_stats render_line(const hittable& world, std::string **output, int j, const hittable& lights,
+                std::chrono::steady_clock::time_point start, stats_images* heat = nullptr)
         {
+            if (seed != 0)
+                seed_random(seed * 2654435761u + j);
+
+            if (wavefront)
+                return render_line_wavefront(world, output, j, lights, start, heat);
+            if (packets)
+                return render_line_packets(world, output, j, lights, start, heat);
+
             // Pre-calculate these values outside all loops
             const int samples = sqrt_spp * sqrt_spp;
             const double inv_samples = 1.0 / samples;
             color* color_arr = new color[samples];
+            line_stats stats;
+            auto line_counters = render_counters::local();
             
             for (int i = 0; i < image_width; i++) {
+#ifdef RT_STATS
+                auto pixel_counters = render_counters::local();
+                auto pixel_rays = stats.rays;
+                auto pixel_start = std::chrono::steady_clock::now();
+#endif
                 color pixel_color(0,0,0);
                 std::fill_n(color_arr, samples, color(0,0,0));
                 
                 for (int s_i = 0; s_i < sqrt_spp; s_i++) {
                     for (int s_j = 0; s_j < sqrt_spp; s_j++) {
-                        sample_color(world, i, j, s_i, s_j, color_arr, lights);
+                        sample_color(world, i, j, s_i, s_j, color_arr, lights, stats.rays);
                     }
                 }
+                stats.paths += samples;
 
                 // Use faster addition method
                 for (int sample = 0; sample < samples; sample++) {
@@ -105,18 +210,173 @@ class camera {
                 // Use pre-calculated inverse instead of multiplication
                 pixel_color *= inv_samples;
                 output[j][i] = write_color(pixel_color);
+
+#ifdef RT_STATS
+                const auto& counters = render_counters::local();
+                heat->nodes.set(i, j, counters.nodes_visited - pixel_counters.nodes_visited);
+                heat->primitives.set(i, j, counters.primitive_tests - pixel_counters.primitive_tests);
+                heat->path_length.set(i, j, double(stats.rays - pixel_rays) / samples);
+                heat->time.set(i, j, std::chrono::duration<double, std::micro>(
+                    std::chrono::steady_clock::now() - pixel_start).count());
+#endif
+
+                if (i == 0) {
+                    stats.first_pixel_seconds =
+                        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                }
             }
             
             delete[] color_arr;
+
+            stats.nodes_visited = render_counters::local().nodes_visited - line_counters.nodes_visited;
+            stats.primitive_tests = render_counters::local().primitive_tests - line_counters.primitive_tests;
+            return stats;
+        }
+
+        line_stats render_line_packets(const hittable& world, std::string **output, int j,
+                const hittable& lights, std::chrono::steady_clock::time_point start,
+                stats_images* heat = nullptr)
+        {
+            // Pixels are taken ray_packet::width at a time. For each sub-pixel stratum the
+            // neighbours' primary rays form one coherent packet; each path then continues alone
+            // from the first hit the packet found for it.
+            const int samples = sqrt_spp * sqrt_spp;
+            line_stats stats;
+            auto line_counters = render_counters::local();
+
+            for (int i0 = 0; i0 < image_width; i0 += ray_packet::width) {
+                int lanes = std::min(ray_packet::width, image_width - i0);
+                color pixel_colors[ray_packet::width];
+#ifdef RT_STATS
+                pixel_cost costs[ray_packet::width];
+#endif
+
+                for (int s_i = 0; s_i < sqrt_spp; s_i++) {
+                    for (int s_j = 0; s_j < sqrt_spp; s_j++) {
+                        ray_packet packet;
+                        ray primary[ray_packet::width];
+                        ray_differential differentials[ray_packet::width];
+                        hit_record recs[ray_packet::width];
+
+                        for (int lane = 0; lane < lanes; lane++) {
+                            primary[lane] = get_ray(i0 + lane, j, s_i, s_j);
+                            differentials[lane] = get_differential(primary[lane]);
+                            packet.set(lane, primary[lane], interval(0.001, infinity));
+                        }
+
+                        unsigned mask = (1u << lanes) - 1;
+#ifdef RT_STATS
+                        auto packet_counters = render_counters::local();
+                        auto packet_start = std::chrono::steady_clock::now();
+#endif
+                        unsigned hits = world.hit_packet(packet, mask, recs);
+#ifdef RT_STATS
+                        // The packet's traversal is shared evenly between its lanes.
+                        for (int lane = 0; lane < lanes; lane++)
+                            costs[lane].add_since(packet_counters, packet_start, 1.0 / lanes);
+#endif
+
+                        for (int lane = 0; lane < lanes; lane++) {
+#ifdef RT_STATS
+                            auto lane_counters = render_counters::local();
+                            auto lane_start = std::chrono::steady_clock::now();
+                            auto lane_rays = stats.rays;
+#endif
+                            bool hit = hits & (1u << lane);
+                            pixel_colors[lane] += ray_color(primary[lane], differentials[lane], max_depth,
+                                                            world, lights, stats.rays, &recs[lane], hit);
+#ifdef RT_STATS
+                            costs[lane].add_since(lane_counters, lane_start, 1.0);
+                            costs[lane].rays += stats.rays - lane_rays;
+#endif
+                        }
+                    }
+                }
+
+                for (int lane = 0; lane < lanes; lane++)
+                    output[j][i0 + lane] = write_color(pixel_colors[lane] * pixel_samples_scale);
+
+#ifdef RT_STATS
+                for (int lane = 0; lane < lanes; lane++)
+                    costs[lane].record(*heat, i0 + lane, j, samples);
+#endif
+
+                if (stats.first_pixel_seconds == 0) {  // This line's first finished pixels
+                    stats.first_pixel_seconds =
+                        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                }
+            }
+
+            stats.paths = (long long)image_width * samples;
+            stats.nodes_visited = render_counters::local().nodes_visited - line_counters.nodes_visited;
+            stats.primitive_tests = render_counters::local().primitive_tests - line_counters.primitive_tests;
+            return stats;
+        }
+
+        line_stats render_line_wavefront(const hittable& world, std::string **output, int j,
+                const hittable& lights, std::chrono::steady_clock::time_point start,
+                stats_images* heat = nullptr)
+        {
+            // Every sample of every pixel on the line goes into one wave.
+            const int samples = sqrt_spp * sqrt_spp;
+            line_stats stats;
+            auto line_counters = render_counters::local();
+#ifdef RT_STATS
+            auto line_start = std::chrono::steady_clock::now();
+#endif
+
+            std::vector<ray> camera_rays;
+            std::vector<ray_differential> differentials;
+            camera_rays.reserve(image_width * samples);
+            differentials.reserve(image_width * samples);
+            for (int i = 0; i < image_width; i++) {
+                for (int s_i = 0; s_i < sqrt_spp; s_i++) {
+                    for (int s_j = 0; s_j < sqrt_spp; s_j++) {
+                        camera_rays.push_back(get_ray(i, j, s_i, s_j));
+                        differentials.push_back(get_differential(camera_rays.back()));
+                    }
+                }
+            }
+
+            std::vector<color> radiance(camera_rays.size(), color(0,0,0));
+            wavefront_integrator integrator(world, lights, background, environment.get(), max_depth,
+                                            russian_roulette_depth);
+            stats.rays = integrator.trace(camera_rays, differentials, radiance);
+            stats.paths = camera_rays.size();
+
+            for (int i = 0; i < image_width; i++) {
+                color pixel_color(0,0,0);
+                for (int sample = 0; sample < samples; sample++)
+                    pixel_color += radiance[i * samples + sample];
+
+                pixel_color *= pixel_samples_scale;
+                output[j][i] = write_color(pixel_color);
+            }
+
+#ifdef RT_STATS
+            // The wave traces the whole line's paths together, so its cost can't be told apart
+            // by pixel: each pixel gets the line's average.
+            pixel_cost line_cost;
+            line_cost.add_since(line_counters, line_start, 1.0 / image_width);
+            line_cost.rays = double(stats.rays) / image_width;
+            for (int i = 0; i < image_width; i++)
+                line_cost.record(*heat, i, j, samples);
+#endif
+
+            stats.first_pixel_seconds =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            stats.nodes_visited = render_counters::local().nodes_visited - line_counters.nodes_visited;
+            stats.primitive_tests = render_counters::local().primitive_tests - line_counters.primitive_tests;
+            return stats;
         }
 
         void sample_color(const hittable& world, int i, int j, int s_i, int s_j,
-                color color_arr[], const hittable& lights)
+                color color_arr[], const hittable& lights, long long& rays)
         {
             // Calculate the index in the color array based on the grid position
             int sample = s_i * sqrt_spp + s_j;
             ray r = get_ray(i, j, s_i, s_j);
-            color_arr[sample] = ray_color(r, max_depth, world, lights);
+            color_arr[sample] = ray_color(r, get_differential(r), max_depth, world, lights, rays);
         }
 
 
@@ -195,6 +455,23 @@ class camera {
         }
 
 
+        ray_differential get_differential(const ray& r) const {
+            // The rays one pixel over in x and in y from the same lens point, pulled in by the
+            // sample spacing as pbrt does, since each sample only stands for its share of the
+            // pixel.
+            ray_differential rd;
+            if (!filter_textures)
+                return rd;
+
+            auto scale = std::fmax(0.125, recip_sqrt_spp);
+            rd.valid = true;
+            rd.rx_origin = rd.ry_origin = r.origin();
+            rd.rx_direction = unit_vector(r.direction() + scale * pixel_delta_u);
+            rd.ry_direction = unit_vector(r.direction() + scale * pixel_delta_v);
+            return rd;
+        }
+
+
         vec3 sample_square_stratified(int s_i, int s_j) const {
             // Returns the vector to a random point in the square sub-pixel specified by grid
             // indices s_i and s_j, for an idealized unit square pixel [-.5,-.5] to [+.5,+.5].
@@ -213,6 +490,23 @@ class camera {
 
 
 
+        void print_stats(const render_stats& stats, const stats_images& heat) const {
+            auto per_ray = [&](long long count) { return stats.rays ? double(count) / stats.rays : 0.0; };
+
+            std::clog << "Render statistics:\n"
+                      << "  camera paths       " << stats.paths << "\n"
+                      << "  rays traced        " << stats.rays << "\n"
+                      << "  mean path length   " << (stats.paths ? double(stats.rays) / stats.paths : 0.0) << "\n"
+                      << "  BVH nodes visited  " << stats.nodes_visited
+                      << " (" << per_ray(stats.nodes_visited) << " per ray)\n"
+                      << "  primitive tests    " << stats.primitive_tests
+                      << " (" << per_ray(stats.primitive_tests) << " per ray)\n"
+                      << (wavefront ? "  worst line/pixel   " : "  worst pixel        ")
+                      << heat.primitives.max() << " primitive tests, " << heat.time.max() << " us\n";
+            if (wavefront)
+                std::clog << "  (wavefront heatmaps are per line: each pixel shows its line's average)\n";
+        }
+
         point3 defocus_disk_sample() const {
             // Returns a random point in the camera defocus disk.
             auto p = random_in_unit_disk();
@@ -220,46 +514,89 @@ class camera {
         }
 
 
-        color ray_color(const ray& r, int depth, const hittable& world, const hittable& lights) const {
+        color ray_color(const ray& r, const ray_differential& rd, int depth, const hittable& world,
+                const hittable& lights, long long& rays, const hit_record* primary_rec = nullptr,
+                bool primary_hit = false)
+        const {
+            // Follows one path for up to `depth` bounces, carrying the radiance gathered so far
+            // and the throughput (the product of attenuation * scattering_pdf / pdf along the
+            // path) instead of recursing once per bounce. If primary_rec is given, the first
+            // intersection has already been found (by packet tracing) and is not repeated.
+            color radiance(0,0,0);
+            color throughput(1,1,1);
+            ray current = r;
+            ray_differential differential = rd;
+
+            for (int bounce = 0; bounce < depth; bounce++) {
+                rays++;
+
+                hit_record rec;
+                bool hit;
+                if (bounce == 0 && primary_rec) {
+                    rec = *primary_rec;
+                    hit = primary_hit;
+                } else {
+                    hit = world.hit(current, interval(0.001, infinity), rec);
+                }
+                if (hit) {
+                    rec.finalize(current);
+                    rec.compute_differentials(differential);
+                }
 
-            if(depth <= 0)
-                return color(0,0,0);
+                // If the ray hits nothing, the background is all that's left to gather
+                if (!hit) {
+                    radiance += throughput * (environment ? environment->value(current.direction())
+                                                          : background);
+                    break;
+                }
 
-            hit_record rec;
-            
-            // If the ray hits nothing, return the background color immediately
-            if (!world.hit(r, interval(0.001, infinity), rec))
-                return background;
+                scatter_record srec;
+                radiance += throughput * rec.mat->emitted(current, rec, rec.u, rec.v, rec.p);
 
-            scatter_record srec;
-            color color_from_emission = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+                if (!rec.mat->scatter(current, rec, srec))
+                    break;
 
-            if (!rec.mat->scatter(r, rec, srec))
-                return color_from_emission;
-            
-            if (srec.skip_pdf) {
-                return srec.attenuation * ray_color(srec.skip_pdf_ray, depth-1, world, lights);
-            }
+                if (srec.skip_pdf) {
+                    throughput = throughput * srec.attenuation;
+                    differential = specular_differential(current, rec, srec, differential);
+                    current = srec.skip_pdf_ray;
+                } else {
+                    // A diffuse bounce spreads over so much that differentials stop helping.
+                    differential.valid = false;
 
-            auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
-            mixture_pdf p(light_ptr, srec.pdf_ptr);
+                    // Equal mixture of light and material sampling, as mixture_pdf does, without
+                    // allocating either pdf on the heap.
+                    hittable_pdf light_pdf(lights, rec.p);
+                    vec3 direction = (random_double() < 0.5) ? light_pdf.generate()
+                                                             : srec.pdf_ptr->generate();
 
-            ray scattered = ray(rec.p, p.generate(), r.time());
-            auto pdf_value = p.value(scattered.direction());
+                    ray scattered = ray(rec.p, direction, current.time());
+                    auto pdf_value = 0.5 * light_pdf.value(direction) + 0.5 * srec.pdf_ptr->value(direction);
 
+                    double scattering_pdf = rec.mat->scattering_pdf(current, rec, scattered);
 
-            double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+                    // Skip extremely low contribution paths
+                    if (pdf_value < 0.00001 || scattering_pdf < 0.00001)
+                        break;
 
-            // Skip extremely low contribution paths
-            if (pdf_value < 0.00001 || scattering_pdf < 0.00001) {
-                return color_from_emission;
-            }
+                    throughput = throughput * srec.attenuation * (scattering_pdf / pdf_value);
+                    current = scattered;
+                }
 
-            color sample_color = ray_color(scattered, depth-1, world, lights);
-            
-            color color_from_scatter = (srec.attenuation * scattering_pdf * sample_color) / pdf_value;
+                // Russian roulette: past the first few bounces, end dim paths early and boost the
+                // survivors by the inverse of their survival chance so the estimate stays unbiased.
+                if (bounce + 1 >= russian_roulette_depth) {
+                    auto survival = std::fmin(1.0, std::fmax(throughput.x(),
+                                                   std::fmax(throughput.y(), throughput.z())));
+                    if (survival < 1.0) {
+                        if (random_double() >= survival)
+                            break;
+                        throughput /= survival;
+                    }
+                }
+            }
 
-            return color_from_emission + color_from_scatter;
+            return radiance;
         }
 };
 
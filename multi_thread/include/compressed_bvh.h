@@ -0,0 +1,202 @@
+#ifndef COMPRESSED_BVH_H
+#define COMPRESSED_BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+
+// A BVH stored as one flat array of small nodes. Only the root box is kept at full precision;
+// each node stores its two children's boxes as integers on a grid spanning the node's own
+// box, with quantized_t (uint8_t or uint16_t) setting the grid resolution. Traversal decodes a
+// child box from its parent's decoded box, and encoding rounds outward against that same
+// decode, so every decoded box contains the true one: a ray can test a few more boxes than
+// with bvh_node, but never misses a primitive.
+//
+// With 8-bit boxes a node takes 24 bytes, against well over 100 for a bvh_node with its two
+// shared_ptr control blocks, so far more of a large mesh's tree stays in cache.
+template <typename quantized_t = std::uint8_t>
+class compressed_bvh : public hittable {
+  public:
+    compressed_bvh(hittable_list list) {
+        trace_scope trace("bvh build", "build");
+
+        objects = list.objects;
+        if (objects.empty())
+            return;
+
+        bbox = list.bounding_box();
+        for (const auto& object : objects)
+            primitives.push_back(object.get());
+
+        root = build(0, objects.size(), bbox);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (objects.empty() || !bbox.hit(r, ray_t))
+            return false;
+
+        if (root < 0)
+            return primitives[~root]->hit(r, ray_t, rec);
+
+        // Node boxes ride along on the stack since they are only known relative to the parent.
+        // Median splits keep the depth within log2(n) + 1, so 64 entries are plenty.
+        struct entry { int ref; aabb box; };
+        entry stack[64];
+        int top = 0;
+        stack[top++] = {root, bbox};
+
+        bool hit_anything = false;
+
+        while (top > 0) {
+            auto current = stack[--top];
+            if (current.ref < 0) {
+                if (primitives[~current.ref]->hit(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+                continue;
+            }
+
+            RT_STAT_INC(nodes_visited);
+            const auto& n = nodes[current.ref];
+
+            aabb child_box[2];
+            decode(current.box, n, child_box);
+
+            // Visit the child nearer along the split axis first: push it last.
+            int near = r.sign(n.axis);
+            for (int k = 0; k < 2; k++) {
+                int c = k == 0 ? 1 - near : near;
+                if (child_box[c].hit(r, ray_t))
+                    stack[top++] = {n.child[c], child_box[c]};
+            }
+        }
+
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+
+    size_t memory_bytes() const {
+        return sizeof(*this) + nodes.capacity() * sizeof(node)
+             + primitives.capacity() * sizeof(const hittable*)
+             + objects.capacity() * sizeof(shared_ptr<hittable>);
+    }
+
+  private:
+    static constexpr int grid_max = std::numeric_limits<quantized_t>::max();
+
+    class node {
+      public:
+        quantized_t lo[2][3];   // Child boxes on the grid spanning this node's box
+        quantized_t hi[2][3];
+        std::int32_t child[2];  // Node index, or ~primitive index for a leaf
+        std::uint8_t axis;      // Split axis, for near-first traversal
+    };
+
+    std::vector<shared_ptr<hittable>> objects;  // Keeps the primitives alive
+    std::vector<const hittable*> primitives;
+    std::vector<node> nodes;
+    aabb bbox;
+    int root = 0;
+
+    static double grid_step(const interval& parent) {
+        return parent.size() * (1.0 / grid_max);
+    }
+
+    static double grid_value(const interval& parent, double step, int q) {
+        // The grid ends are pinned to the parent's ends exactly, so q = grid_max never falls
+        // short of the parent's max through rounding.
+        return q == grid_max ? parent.max : parent.min + q * step;
+    }
+
+    static void decode(const aabb& parent, const node& n, aabb children[2]) {
+        // Both children share the parent's grid, so its step is worked out once per axis.
+        interval axes[2][3];
+        for (int a = 0; a < 3; a++) {
+            const auto& p = parent.axis_interval(a);
+            auto step = grid_step(p);
+            for (int c = 0; c < 2; c++)
+                axes[c][a] = interval(grid_value(p, step, n.lo[c][a]),
+                                      grid_value(p, step, n.hi[c][a]));
+        }
+        for (int c = 0; c < 2; c++)
+            children[c] = aabb(axes[c][0], axes[c][1], axes[c][2]);
+    }
+
+    static void encode(const aabb& parent, const aabb& box, node& n, int c) {
+        // Round outward, then step further out until the decoded value really covers the box.
+        for (int a = 0; a < 3; a++) {
+            const auto& p = parent.axis_interval(a);
+            const auto& b = box.axis_interval(a);
+            auto step = grid_step(p);
+            auto scale = step > 0 ? 1 / step : 0.0;
+
+            int lo = int(std::floor((b.min - p.min) * scale));
+            int hi = int(std::ceil((b.max - p.min) * scale));
+            lo = std::clamp(lo, 0, grid_max);
+            hi = std::clamp(hi, 0, grid_max);
+
+            while (lo > 0 && grid_value(p, step, lo) > b.min) lo--;
+            while (hi < grid_max && grid_value(p, step, hi) < b.max) hi++;
+
+            n.lo[c][a] = quantized_t(lo);
+            n.hi[c][a] = quantized_t(hi);
+        }
+    }
+
+    int build(size_t start, size_t end, const aabb& node_box) {
+        // Returns a reference to the subtree for objects[start, end): a leaf for a single
+        // object, otherwise a node split at the median along the longest axis of the objects'
+        // bounds. node_box is the box traversal will decode for this node.
+        if (end - start == 1)
+            return ~int(start);
+
+        aabb span_box = aabb::empty;
+        for (size_t i = start; i < end; i++)
+            span_box = aabb(span_box, objects[i]->bounding_box());
+
+        int axis = span_box.longest_axis();
+        auto mid = start + (end - start) / 2;
+        auto key = [axis](const shared_ptr<hittable>& o) {
+            return o->bounding_box().axis_interval(axis).min;
+        };
+        std::nth_element(objects.begin() + start, objects.begin() + mid, objects.begin() + end,
+                         [&](const auto& a, const auto& b) { return key(a) < key(b); });
+        for (size_t i = start; i < end; i++)
+            primitives[i] = objects[i].get();
+
+        int index = int(nodes.size());
+        nodes.emplace_back();
+        nodes[index].axis = std::uint8_t(axis);
+
+        size_t ranges[2][2] = { {start, mid}, {mid, end} };
+        for (int c = 0; c < 2; c++) {
+            aabb child_box = aabb::empty;
+            for (size_t i = ranges[c][0]; i < ranges[c][1]; i++)
+                child_box = aabb(child_box, objects[i]->bounding_box());
+            encode(node_box, child_box, nodes[index], c);
+        }
+
+        aabb decoded[2];
+        decode(node_box, nodes[index], decoded);
+        for (int c = 0; c < 2; c++) {
+            auto child = build(ranges[c][0], ranges[c][1], decoded[c]);
+            nodes[index].child[c] = child;  // nodes may have grown; index again
+        }
+
+        return index;
+    }
+};
+
+#endif
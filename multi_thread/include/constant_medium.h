@@ -48,12 +48,17 @@ class constant_medium : public hittable {
         rec.normal = vec3(1,0,0);  // arbitrary
         rec.front_face = true;     // also arbitrary
         rec.mat = phase_function;
+        rec.prim = nullptr;        // Filled in already
 
         return true;
     }
 
     aabb bounding_box() const override { return boundary->bounding_box(); }
 
+    aabb bounding_box_at(double time) const override { return boundary->bounding_box_at(time); }
+
+    int motion_segments() const override { return boundary->motion_segments(); }
+
   private:
     shared_ptr<hittable> boundary;
     double neg_inv_density;
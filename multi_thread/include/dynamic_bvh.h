@@ -0,0 +1,442 @@
+#ifndef DYNAMIC_BVH_H
+#define DYNAMIC_BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+
+// A BVH whose objects can be added, removed and moved between frames. Nodes live in one array
+// with parent links, so a change only touches the path above it:
+//
+//   add      Inserts a leaf next to the sibling that grows the tree's surface area least.
+//   remove   Unlinks the leaf and lets its sibling take the parent's place.
+//   set      Replaces an object (typically with a re-positioned translate or rotate_y wrapper);
+//            moved marks an object whose bounds changed in place.
+//
+// update, called once per frame before rendering, refits the boxes of every changed path from
+// the leaves up, spreading independent subtrees over threads. It then looks for subtrees whose
+// surface area cost has grown past rebuild_threshold times what it was when last built, and
+// rebuilds only those. Camera-only animation needs no update at all.
+//
+// Not safe to change while rays are being traced.
+class dynamic_bvh : public hittable {
+  public:
+    // A subtree is rebuilt once its cost per unit of its own area grows by this factor.
+    double rebuild_threshold = 1.25;
+
+    // Subtrees smaller than this are never rebuilt on their own; it isn't worth the bookkeeping.
+    int min_rebuild_leaves = 8;
+
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+
+    dynamic_bvh() {}
+
+    dynamic_bvh(const hittable_list& list) {
+        trace_scope trace("bvh build", "build");
+
+        std::vector<int> leaves;
+        for (const auto& object : list.objects) {
+            int handle = new_handle(object);
+            leaves.push_back(leaf[handle] = new_leaf(handle));
+        }
+        if (!leaves.empty())
+            root = build(leaves, 0, leaves.size(), -1);
+    }
+
+    int add(shared_ptr<hittable> object) {
+        // Returns the handle to pass to remove, set and moved.
+        int handle = new_handle(object);
+        int n = new_leaf(handle);
+        leaf[handle] = n;
+        insert(n);
+        return handle;
+    }
+
+    void remove(int handle) {
+        int n = leaf[handle];
+        unlink(n);
+        free_node(n);
+        objects[handle] = nullptr;
+        leaf[handle] = -1;
+        free_handles.push_back(handle);
+    }
+
+    void set(int handle, shared_ptr<hittable> object) {
+        objects[handle] = object;
+        moved(handle);
+    }
+
+    void moved(int handle) {
+        for (int n = leaf[handle]; n >= 0 && !nodes[n].dirty; n = nodes[n].parent)
+            nodes[n].dirty = true;
+    }
+
+    void update() {
+        trace_scope trace("bvh update", "build");
+
+        refitted_nodes = 0;
+        rebuilt_leaves = 0;
+        if (root < 0 || !nodes[root].dirty)
+            return;
+
+        frame++;
+        refit_parallel();
+        rebuild_degraded(root);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        return root >= 0 && hit_subtree(root, r, ray_t, rec);
+    }
+
+    aabb bounding_box() const override { return root >= 0 ? nodes[root].box : aabb::empty; }
+
+    // What the last update did, for measuring it.
+    long long refitted_nodes = 0;
+    long long rebuilt_leaves = 0;
+
+  private:
+    class node {
+      public:
+        aabb box;
+        int parent = -1;
+        int left = -1, right = -1;  // Both -1 for a leaf
+        int object = -1;            // Handle, for a leaf
+        int leaves = 1;             // Leaves in this subtree
+        double cost = 0;            // Surface area cost of the subtree: the sum of its areas
+        double built_ratio = 0;     // cost / area when the subtree was last (re)built
+        bool dirty = false;         // Something below changed since the last update
+        long long refit_frame = -1;
+
+        bool is_leaf() const { return left < 0; }
+    };
+
+    std::vector<shared_ptr<hittable>> objects;  // By handle
+    std::vector<int> leaf;                      // Leaf node of each handle
+    std::vector<int> free_handles;
+    std::vector<node> nodes;
+    std::vector<int> free_nodes;
+    int root = -1;
+    long long frame = 0;
+
+    static double area(const aabb& box) {
+        auto dx = box.x.size(), dy = box.y.size(), dz = box.z.size();
+        return dx*dy + dy*dz + dz*dx;
+    }
+
+    int new_handle(shared_ptr<hittable> object) {
+        if (!free_handles.empty()) {
+            int handle = free_handles.back();
+            free_handles.pop_back();
+            objects[handle] = object;
+            return handle;
+        }
+        objects.push_back(object);
+        leaf.push_back(-1);
+        return int(objects.size()) - 1;
+    }
+
+    int new_node() {
+        if (!free_nodes.empty()) {
+            int n = free_nodes.back();
+            free_nodes.pop_back();
+            nodes[n] = node();
+            return n;
+        }
+        nodes.emplace_back();
+        return int(nodes.size()) - 1;
+    }
+
+    void free_node(int n) { free_nodes.push_back(n); }
+
+    int new_leaf(int handle) {
+        int n = new_node();
+        nodes[n].object = handle;
+        nodes[n].box = objects[handle]->bounding_box();
+        nodes[n].cost = area(nodes[n].box);
+        return n;
+    }
+
+    void refit_node(int n) {
+        // Recomputes one node from its object or its (already refitted) children.
+        auto& nd = nodes[n];
+        if (nd.is_leaf()) {
+            nd.box = objects[nd.object]->bounding_box();
+            nd.cost = area(nd.box);
+        } else {
+            const auto& l = nodes[nd.left];
+            const auto& r = nodes[nd.right];
+            nd.box = aabb(l.box, r.box);
+            nd.leaves = l.leaves + r.leaves;
+            nd.cost = area(nd.box) + l.cost + r.cost;
+        }
+    }
+
+    void refit_path(int n) {
+        // After an insertion or removal: refit every ancestor now and flag them for the
+        // rebuild check in the next update.
+        for (; n >= 0; n = nodes[n].parent) {
+            refit_node(n);
+            nodes[n].dirty = true;
+        }
+    }
+
+    void insert(int n) {
+        if (root < 0) {
+            root = n;
+            nodes[n].dirty = true;
+            return;
+        }
+
+        // Walk down toward the sibling whose enlargement costs least, counting the growth of
+        // every ancestor on the way (the branch-and-bound of Box2D's dynamic tree, greedily).
+        const aabb& box = nodes[n].box;
+        int sibling = root;
+        while (!nodes[sibling].is_leaf()) {
+            const auto& s = nodes[sibling];
+            auto combined = area(aabb(s.box, box));
+            auto here = 2 * combined;
+            auto inherited = 2 * (combined - area(s.box));
+
+            auto descend_cost = [&](int c) {
+                const auto& child = nodes[c];
+                auto grown = area(aabb(child.box, box));
+                return inherited + (child.is_leaf() ? grown : grown - area(child.box));
+            };
+            auto cost_left = descend_cost(s.left);
+            auto cost_right = descend_cost(s.right);
+
+            if (here < cost_left && here < cost_right)
+                break;
+            sibling = cost_left < cost_right ? s.left : s.right;
+        }
+
+        int old_parent = nodes[sibling].parent;
+        int parent = new_node();
+        nodes[parent].parent = old_parent;
+        nodes[parent].left = sibling;
+        nodes[parent].right = n;
+        nodes[sibling].parent = parent;
+        nodes[n].parent = parent;
+
+        if (old_parent < 0)
+            root = parent;
+        else if (nodes[old_parent].left == sibling)
+            nodes[old_parent].left = parent;
+        else
+            nodes[old_parent].right = parent;
+
+        nodes[n].dirty = true;
+        refit_path(parent);
+        nodes[parent].built_ratio = nodes[parent].cost / area(nodes[parent].box);
+    }
+
+    void unlink(int n) {
+        int parent = nodes[n].parent;
+        if (parent < 0) {
+            root = -1;
+            return;
+        }
+
+        int sibling = nodes[parent].left == n ? nodes[parent].right : nodes[parent].left;
+        int grandparent = nodes[parent].parent;
+        nodes[sibling].parent = grandparent;
+
+        if (grandparent < 0)
+            root = sibling;
+        else if (nodes[grandparent].left == parent)
+            nodes[grandparent].left = sibling;
+        else
+            nodes[grandparent].right = sibling;
+
+        free_node(parent);
+        refit_path(grandparent);
+        if (grandparent < 0)
+            nodes[sibling].dirty = true;
+    }
+
+    long long refit_subtree(int n) {
+        // Refits the changed nodes under n and returns how many there were.
+        auto& nd = nodes[n];
+        if (!nd.dirty || nd.refit_frame == frame)
+            return 0;
+
+        long long count = 1;
+        if (!nd.is_leaf())
+            count += refit_subtree(nd.left) + refit_subtree(nd.right);
+        refit_node(n);
+        nd.refit_frame = frame;
+        return count;
+    }
+
+    void refit_parallel() {
+        // Splits the changed part of the tree into subtrees small enough to share out, refits
+        // those on worker threads, then refits the few nodes above them here.
+        std::vector<int> tasks;
+        std::vector<int> top;
+        auto grain = std::max(64, nodes[root].leaves / (4 * threads));
+
+        std::vector<int> pending{root};
+        while (!pending.empty()) {
+            int n = pending.back();
+            pending.pop_back();
+            const auto& nd = nodes[n];
+            if (!nd.dirty)
+                continue;
+            if (nd.is_leaf() || nd.leaves <= grain) {
+                tasks.push_back(n);
+            } else {
+                top.push_back(n);
+                pending.push_back(nd.left);
+                pending.push_back(nd.right);
+            }
+        }
+
+        std::atomic<size_t> next{0};
+        std::atomic<long long> count{0};
+        auto worker = [&] {
+            for (size_t i; (i = next++) < tasks.size();)
+                count += refit_subtree(tasks[i]);
+        };
+
+        int worker_count = std::min(threads, int(tasks.size() / 2));
+        std::vector<std::thread> pool;
+        for (int i = 1; i < worker_count; i++)
+            pool.emplace_back(worker);
+        worker();
+        for (auto& t : pool)
+            t.join();
+
+        // `top` lists parents before children; refit it in reverse.
+        for (auto it = top.rbegin(); it != top.rend(); ++it) {
+            refit_node(*it);
+            nodes[*it].refit_frame = frame;
+        }
+
+        refitted_nodes = count + top.size();
+    }
+
+    void rebuild_degraded(int n) {
+        // Rebuilds the highest changed subtrees whose cost has degraded, then brings the
+        // changed ancestors' costs up to date with the result.
+        auto& nd = nodes[n];
+        if (!nd.dirty)
+            return;
+        nd.dirty = false;
+
+        if (nd.is_leaf())
+            return;
+
+        auto ratio = nd.cost / area(nd.box);
+        if (nd.leaves >= min_rebuild_leaves && ratio > rebuild_threshold * nd.built_ratio) {
+            rebuild(n);
+            return;
+        }
+
+        rebuild_degraded(nodes[n].left);
+        rebuild_degraded(nodes[n].right);
+        refit_node(n);
+    }
+
+    void collect(int n, std::vector<int>& leaves) {
+        if (nodes[n].is_leaf()) {
+            nodes[n].dirty = false;
+            leaves.push_back(n);
+            return;
+        }
+        collect(nodes[n].left, leaves);
+        collect(nodes[n].right, leaves);
+        free_node(n);
+    }
+
+    void rebuild(int n) {
+        // Rebuilds the subtree rooted at n in place, keeping its node index for its parent.
+        int parent = nodes[n].parent;
+        std::vector<int> leaves;
+        collect(n, leaves);
+        rebuilt_leaves += leaves.size();
+
+        // collect frees n last, so the first node build allocates, the new subtree root, reuses
+        // n's index and the parent's link stays valid.
+        build(leaves, 0, leaves.size(), parent);
+    }
+
+    int build(std::vector<int>& leaves, size_t start, size_t end, int parent) {
+        // Top-down median split along the longest axis of the leaves' centroids.
+        if (end - start == 1) {
+            int n = leaves[start];
+            nodes[n].parent = parent;
+            nodes[n].dirty = false;
+            refit_node(n);
+            return n;
+        }
+
+        aabb centroids = aabb::empty;
+        for (size_t i = start; i < end; i++) {
+            const auto& b = nodes[leaves[i]].box;
+            auto c = point3((b.x.min + b.x.max) / 2, (b.y.min + b.y.max) / 2, (b.z.min + b.z.max) / 2);
+            centroids = aabb(centroids, aabb(c, c));
+        }
+        int axis = centroids.longest_axis();
+
+        auto mid = start + (end - start) / 2;
+        std::nth_element(leaves.begin() + start, leaves.begin() + mid, leaves.begin() + end,
+            [&](int a, int b) {
+                const auto& ia = nodes[a].box.axis_interval(axis);
+                const auto& ib = nodes[b].box.axis_interval(axis);
+                return ia.min + ia.max < ib.min + ib.max;
+            });
+
+        int n = new_node();
+        nodes[n].parent = parent;
+        int left = build(leaves, start, mid, n);
+        int right = build(leaves, mid, end, n);
+        nodes[n].left = left;
+        nodes[n].right = right;
+        refit_node(n);
+        nodes[n].built_ratio = nodes[n].cost / area(nodes[n].box);
+        return n;
+    }
+
+    bool hit_subtree(int start, const ray& r, interval ray_t, hit_record& rec) const {
+        // Iterative, with a fixed stack; a subtree that would overflow it is walked recursively.
+        int stack[64];
+        int top = 0;
+        stack[top++] = start;
+        bool hit_anything = false;
+
+        while (top > 0) {
+            const auto& nd = nodes[stack[--top]];
+            RT_STAT_INC(nodes_visited);
+            if (!nd.box.hit(r, ray_t))
+                continue;
+
+            if (nd.is_leaf()) {
+                if (objects[nd.object]->hit(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            } else if (top + 2 > 64) {
+                for (int c : {nd.left, nd.right}) {
+                    if (hit_subtree(c, r, ray_t, rec)) {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                }
+            } else {
+                stack[top++] = nd.right;
+                stack[top++] = nd.left;
+            }
+        }
+
+        return hit_anything;
+    }
+};
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "color.h"
+#include "hittable.h"
+#include "rtw_stb_image.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+// Light arriving from infinitely far away in every direction, from an equirectangular image
+// (an .hdr for real skies; an LDR image works too, linearized by stb). Directions map to image
+// coordinates the way sphere::get_sphere_uv maps points, with +y at the image's top row.
+//
+// For sampling, the image is a 2D piecewise-constant distribution over its pixels, each
+// weighted by its luminance times sin(theta) for the area it covers on the sphere: a marginal
+// over rows and a conditional over each row's pixels, built once at load. A sampled pixel is
+// then sampled uniformly, so the pdf over solid angle is the pixel's share divided by the
+// (u,v)-to-sphere Jacobian 2 pi^2 sin(theta).
+class environment_light : public hittable {
+  public:
+    environment_light(const char* filename, double scale = 1.0)
+      : image(filename, false), scale(scale) {
+        trace_scope trace("environment build", "load");
+
+        width = image.width();
+        height = image.height();
+        if (width == 0 || height == 0) {
+            width = height = 1;  // rtw_image returns magenta for everything
+        }
+
+        row_cdf.assign(height + 1, 0.0);
+        column_cdf.assign(size_t(height) * (width + 1), 0.0);
+        weights.resize(size_t(width) * height);
+
+        for (int j = 0; j < height; j++) {
+            auto theta = pi * (j + 0.5) / height;
+            auto sin_theta = std::sin(theta);
+            auto* cdf = &column_cdf[size_t(j) * (width + 1)];
+            for (int i = 0; i < width; i++) {
+                auto w = luminance(texel(i, j)) * sin_theta;
+                weights[size_t(j) * width + i] = w;
+                cdf[i + 1] = cdf[i] + w;
+            }
+            row_cdf[j + 1] = row_cdf[j] + cdf[width];
+        }
+        total = row_cdf[height];
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override { return false; }
+
+    aabb bounding_box() const override { return aabb::empty; }
+
+    // Radiance arriving along a ray leaving in `direction`.
+    color value(const vec3& direction) const {
+        int i, j;
+        pixel_of(unit_vector(direction), i, j);
+        return scale * texel(i, j);
+    }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        if (!(total > 0))
+            return 1 / (4 * pi);
+
+        auto d = unit_vector(direction);
+        auto sin_theta = std::sqrt(std::fmax(0.0, 1 - d.y() * d.y()));
+        if (sin_theta == 0)
+            return 0;
+
+        int i, j;
+        pixel_of(d, i, j);
+        auto pdf_uv = weights[size_t(j) * width + i] / total * width * height;
+        return pdf_uv / (2 * pi * pi * sin_theta);
+    }
+
+    vec3 random(const point3& origin) const override {
+        if (!(total > 0))
+            return random_unit_vector();
+
+        // Row by the marginal, pixel by that row's conditional, then uniformly in the pixel.
+        auto j = sample_cdf(&row_cdf[0], height, random_double() * total);
+        const auto* cdf = &column_cdf[size_t(j) * (width + 1)];
+        auto i = sample_cdf(cdf, width, random_double() * cdf[width]);
+
+        auto u = (i + random_double()) / width;
+        auto v = 1 - (j + random_double()) / height;
+        return direction_of(u, v);
+    }
+
+  private:
+    rtw_image image;
+    double scale;
+    int width, height;
+    std::vector<double> weights;     // Per pixel, row by row
+    std::vector<double> row_cdf;     // height + 1 entries
+    std::vector<double> column_cdf;  // width + 1 entries per row
+    double total = 0;
+
+    color texel(int i, int j) const {
+        auto pixel = image.float_pixel_data(i, j);
+        return color(pixel[0], pixel[1], pixel[2]);
+    }
+
+    static int sample_cdf(const double* cdf, int n, double x) {
+        // The bucket k with cdf[k] <= x < cdf[k+1], skipping empty buckets.
+        auto k = int(std::upper_bound(cdf + 1, cdf + n + 1, x) - (cdf + 1));
+        return std::min(k, n - 1);
+    }
+
+    void pixel_of(const vec3& d, int& i, int& j) const {
+        auto theta = std::acos(std::clamp(-d.y(), -1.0, 1.0));
+        auto phi = std::atan2(-d.z(), d.x()) + pi;
+        auto u = phi / (2*pi);
+        auto v = theta / pi;
+
+        i = std::clamp(int(u * width), 0, width - 1);
+        j = std::clamp(int((1 - v) * height), 0, height - 1);
+    }
+
+    static vec3 direction_of(double u, double v) {
+        // The inverse of pixel_of's mapping.
+        auto theta = v * pi;
+        auto phi = u * 2*pi - pi;
+        auto sin_theta = std::sin(theta);
+        return vec3(sin_theta * std::cos(phi), -std::cos(theta), -sin_theta * std::sin(phi));
+    }
+};
+
+
+// A scene's lights with an environment around them. The environment takes a fixed share of
+// the light samples and the lights the rest, the way pbrt's light samplers treat infinite
+// lights; with no other lights it takes them all.
+class environment_and_lights : public hittable {
+  public:
+    environment_and_lights(const environment_light& environment, const hittable& lights)
+      : environment(environment), lights(lights)
+    {
+        environment_share = lights.empty() ? 1.0 : 0.5;
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override { return false; }
+
+    aabb bounding_box() const override { return lights.bounding_box(); }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        auto pdf = environment_share * environment.pdf_value(origin, direction);
+        if (environment_share < 1)
+            pdf += (1 - environment_share) * lights.pdf_value(origin, direction);
+        return pdf;
+    }
+
+    vec3 random(const point3& origin) const override {
+        if (random_double() < environment_share)
+            return environment.random(origin);
+        return lights.random(origin);
+    }
+
+  private:
+    const environment_light& environment;
+    const hittable& lights;
+    double environment_share;
+};
+
+#endif
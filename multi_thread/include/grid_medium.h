@@ -0,0 +1,321 @@
+#ifndef GRID_MEDIUM_H
+#define GRID_MEDIUM_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "material.h"
+#include "texture.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+
+// Densities on a voxel grid over a box, interpolated trilinearly between voxel centers. Points
+// outside the box have density 0; points in it but outside the outermost centers are clamped
+// to them.
+class density_grid {
+  public:
+    density_grid() {}
+
+    // An nx x ny x nz grid over box, sampled from density at each voxel's center.
+    density_grid(const aabb& box, int nx, int ny, int nz,
+                 const std::function<double(const point3&)>& density)
+      : box(box), nx(std::max(nx, 1)), ny(std::max(ny, 1)), nz(std::max(nz, 1))
+    {
+        trace_scope trace("density grid build", "load");
+        values.resize(size_t(this->nx) * this->ny * this->nz);
+        for (int k = 0; k < this->nz; k++)
+            for (int j = 0; j < this->ny; j++)
+                for (int i = 0; i < this->nx; i++)
+                    values[index(i, j, k)] = float(std::fmax(0.0, density(voxel_center(i, j, k))));
+    }
+
+    // The first channel of a Mitsuba .vol file of 32-bit floats, stretched over box rather than
+    // the bounds the file gives. A file that can't be read leaves the grid empty.
+    density_grid(const char* filename, const aabb& box) : box(box) {
+        trace_scope trace("density grid load", "load");
+
+        std::ifstream file(filename, std::ios::binary);
+        char magic[4] = {};
+        int32_t header[5] = {};  // Encoding, resolution along x, y and z, channels
+        float bounds[6];
+        file.read(magic, 4);
+        file.read(reinterpret_cast<char*>(header), sizeof(header));
+        file.read(reinterpret_cast<char*>(bounds), sizeof(bounds));
+
+        bool valid = file && std::memcmp(magic, "VOL\3", 4) == 0 && header[0] == 1
+                  && header[1] > 0 && header[2] > 0 && header[3] > 0 && header[4] > 0;
+        if (valid) {
+            nx = header[1];
+            ny = header[2];
+            nz = header[3];
+            auto channels = size_t(header[4]);
+            std::vector<float> data(size_t(nx) * ny * nz * channels);
+            file.read(reinterpret_cast<char*>(data.data()), data.size() * sizeof(float));
+            valid = bool(file);
+
+            values.resize(size_t(nx) * ny * nz);
+            for (size_t v = 0; valid && v < values.size(); v++)
+                values[v] = std::fmax(0.0f, data[v * channels]);
+        }
+
+        if (!valid) {
+            std::cerr << "ERROR: Could not load volume file '" << filename << "'.\n";
+            nx = ny = nz = 0;
+            values.clear();
+        }
+    }
+
+    bool empty() const { return values.empty(); }
+
+    const aabb& bounds() const { return box; }
+
+    int resolution(int axis) const { return axis == 0 ? nx : axis == 1 ? ny : nz; }
+
+    double value(const point3& p) const {
+        if (empty() || !box.x.contains(p.x()) || !box.y.contains(p.y()) || !box.z.contains(p.z()))
+            return 0;
+
+        auto x = coordinate(p.x(), box.x, nx);
+        auto y = coordinate(p.y(), box.y, ny);
+        auto z = coordinate(p.z(), box.z, nz);
+        auto i0 = int(x), i1 = std::min(i0 + 1, nx - 1);
+        auto j0 = int(y), j1 = std::min(j0 + 1, ny - 1);
+        auto k0 = int(z), k1 = std::min(k0 + 1, nz - 1);
+        auto fx = x - i0, fy = y - j0, fz = z - k0;
+
+        auto plane = [&](int k) {
+            return (1 - fy) * ((1 - fx) * voxel(i0, j0, k) + fx * voxel(i1, j0, k))
+                 +      fy  * ((1 - fx) * voxel(i0, j1, k) + fx * voxel(i1, j1, k));
+        };
+        return (1 - fz) * plane(k0) + fz * plane(k1);
+    }
+
+    double voxel(int i, int j, int k) const { return values[index(i, j, k)]; }
+
+  private:
+    aabb box;
+    int nx = 0, ny = 0, nz = 0;
+    std::vector<float> values;  // x fastest, then y, then z
+
+    size_t index(int i, int j, int k) const { return (size_t(k) * ny + j) * nx + i; }
+
+    point3 voxel_center(int i, int j, int k) const {
+        return point3(box.x.min + box.x.size() * (i + 0.5) / nx,
+                      box.y.min + box.y.size() * (j + 0.5) / ny,
+                      box.z.min + box.z.size() * (k + 0.5) / nz);
+    }
+
+    static double coordinate(double x, const interval& extent, int n) {
+        // In voxels, with centers at integers, clamped to the outermost centers.
+        auto t = extent.size() > 0 ? (x - extent.min) / extent.size() : 0.5;
+        return interval(0, n - 1).clamp(t * n - 0.5);
+    }
+};
+
+
+// A medium whose density varies through a box, given by a density_grid times a scale, with
+// the same isotropic scattering as constant_medium. Where constant_medium samples one
+// exponential distance, this one finds where a ray scatters by delta tracking: distances are
+// sampled against a majorant, a density at least as high as the real one, and each tentative
+// collision at x is kept with probability density(x) / majorant, or else tracking goes on from
+// there. The result has the same distribution as sampling the real density exactly.
+//
+// A single majorant for the whole box would make tracking take as many steps through thin
+// smoke as through its densest core. Instead a coarse grid, one cell per block_size voxels on a
+// side, keeps the highest density each cell's lookups can reach, and rays walk it cell by cell
+// (Amanatides and Woo's traversal), tracking each stretch against its own cell's majorant.
+// Cells with nothing in them have majorant 0 and are crossed without sampling at all.
+//
+// The box is entered and left with one slab test, rather than two hits against a boundary
+// object.
+class grid_medium : public hittable {
+  public:
+    grid_medium(const density_grid& grid, double density_scale, shared_ptr<texture> tex)
+      : grid(grid), density_scale(density_scale), phase_function(make_shared<isotropic>(tex))
+    {
+        build_majorants();
+    }
+
+    grid_medium(const density_grid& grid, double density_scale, const color& albedo)
+      : grid(grid), density_scale(density_scale), phase_function(make_shared<isotropic>(albedo))
+    {
+        build_majorants();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        auto collision = infinity;
+        traverse(r, ray_t, [&](double t0, double t1, double majorant) {
+            // Densities and distances in units of the ray's parameter.
+            auto rate = majorant * r.direction().length();
+            for (auto t = t0;;) {
+                t -= std::log(1 - random_double()) / rate;
+                if (t >= t1)
+                    return true;
+                if (random_double() * majorant < density_scale * grid.value(r.at(t))) {
+                    collision = t;
+                    return false;
+                }
+            }
+        });
+
+        if (collision == infinity)
+            return false;
+
+        rec.t = collision;
+        rec.p = r.at(rec.t);
+
+        rec.normal = vec3(1,0,0);  // arbitrary
+        rec.front_face = true;     // also arbitrary
+        rec.mat = phase_function;
+        rec.prim = nullptr;        // Filled in already
+
+        return true;
+    }
+
+    // The fraction of light getting through the medium along r over ray_t, for visibility
+    // between two points. It's estimated by ratio tracking: tentative collisions are sampled
+    // the same way as in hit(), but each one scales the estimate by 1 - density / majorant
+    // instead of ending the walk, so it returns a fraction rather than all or nothing, with
+    // much less variance. Once the estimate is small, Russian roulette ends most walks early.
+    double transmittance(const ray& r, interval ray_t) const {
+        auto estimate = 1.0;
+        traverse(r, ray_t, [&](double t0, double t1, double majorant) {
+            auto rate = majorant * r.direction().length();
+            for (auto t = t0;;) {
+                t -= std::log(1 - random_double()) / rate;
+                if (t >= t1)
+                    return true;
+
+                estimate *= 1 - density_scale * grid.value(r.at(t)) / majorant;
+                if (estimate < 0.1) {
+                    if (random_double() < 0.5) {
+                        estimate = 0;
+                        return false;
+                    }
+                    estimate *= 2;
+                }
+            }
+        });
+        return estimate;
+    }
+
+    aabb bounding_box() const override { return grid.bounds(); }
+
+  private:
+    static const int block_size = 8;  // Voxels on a side per majorant cell
+
+    density_grid grid;
+    double density_scale;
+    shared_ptr<material> phase_function;
+    int cells[3];                  // Majorant cells along each axis
+    std::vector<float> majorants;  // Scaled densities, x fastest, then y, then z
+
+    void build_majorants() {
+        for (int a = 0; a < 3; a++)
+            cells[a] = (grid.resolution(a) + block_size - 1) / block_size;
+        majorants.assign(size_t(cells[0]) * cells[1] * cells[2], 0.0f);
+
+        // Lookups in a cell interpolate voxels from one before its block to one after it.
+        auto span = [&](int a, int c, int& first, int& last) {
+            first = std::max(c * block_size - 1, 0);
+            last = std::min((c + 1) * block_size, grid.resolution(a) - 1);
+        };
+
+        for (int ck = 0; ck < cells[2]; ck++) {
+            for (int cj = 0; cj < cells[1]; cj++) {
+                for (int ci = 0; ci < cells[0]; ci++) {
+                    int i0, i1, j0, j1, k0, k1;
+                    span(0, ci, i0, i1);
+                    span(1, cj, j0, j1);
+                    span(2, ck, k0, k1);
+
+                    double highest = 0;
+                    for (int k = k0; k <= k1; k++)
+                        for (int j = j0; j <= j1; j++)
+                            for (int i = i0; i <= i1; i++)
+                                highest = std::fmax(highest, grid.voxel(i, j, k));
+
+                    // Rounded up, so the float never falls below the density it bounds.
+                    auto m = float(density_scale * highest);
+                    if (m < density_scale * highest)
+                        m = std::nextafter(m, INFINITY);
+                    majorants[(size_t(ck) * cells[1] + cj) * cells[0] + ci] = m;
+                }
+            }
+        }
+    }
+
+    // Calls visit(t0, t1, majorant) for each stretch of ray_t inside the box, in order, one per
+    // majorant cell crossed, skipping empty cells, until visit returns false.
+    template <typename visitor>
+    void traverse(const ray& r, interval ray_t, const visitor& visit) const {
+        if (grid.empty())
+            return;
+
+        const auto& box = grid.bounds();
+        const auto& origin = r.origin();
+        const auto& direction = r.direction();
+        const auto& inv_dir = r.inv_direction();
+
+        // The slab test; fmax and fmin drop the NaN of a ray lying in a slab's plane.
+        for (int a = 0; a < 3; a++) {
+            const auto& ax = box.axis_interval(a);
+            auto t_near = (ax.min - origin[a]) * inv_dir[a];
+            auto t_far  = (ax.max - origin[a]) * inv_dir[a];
+            if (t_near > t_far) std::swap(t_near, t_far);
+            ray_t.min = std::fmax(ray_t.min, t_near);
+            ray_t.max = std::fmin(ray_t.max, t_far);
+        }
+        if (!(ray_t.min < ray_t.max))
+            return;
+
+        // The cell where the ray enters, and where it next crosses a cell boundary on each axis.
+        auto entry = r.at(ray_t.min);
+        int cell[3], step[3];
+        double t_next[3], t_delta[3];
+        for (int a = 0; a < 3; a++) {
+            const auto& ax = box.axis_interval(a);
+            auto cell_size = ax.size() * block_size / grid.resolution(a);
+            cell[a] = std::clamp(int((entry[a] - ax.min) / cell_size), 0, cells[a] - 1);
+
+            if (direction[a] == 0) {
+                step[a] = 0;
+                t_next[a] = t_delta[a] = infinity;
+                continue;
+            }
+            step[a] = direction[a] > 0 ? 1 : -1;
+            auto boundary = ax.min + (cell[a] + (step[a] > 0)) * cell_size;
+            t_next[a] = (boundary - origin[a]) * inv_dir[a];
+            t_delta[a] = cell_size * std::fabs(inv_dir[a]);
+        }
+
+        auto t = ray_t.min;
+        while (true) {
+            int a = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2)
+                                          : (t_next[1] < t_next[2] ? 1 : 2);
+            auto t_exit = std::fmin(t_next[a], ray_t.max);
+
+            auto majorant = majorants[(size_t(cell[2]) * cells[1] + cell[1]) * cells[0] + cell[0]];
+            if (majorant > 0 && t_exit > t && !visit(t, t_exit, double(majorant)))
+                return;
+
+            if (t_exit >= ray_t.max)
+                return;
+            t = t_exit;
+            cell[a] += step[a];
+            if (cell[a] < 0 || cell[a] >= cells[a])
+                return;
+            t_next[a] += t_delta[a];
+        }
+    }
+};
+
+#endif
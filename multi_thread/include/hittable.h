@@ -6,9 +6,15 @@
 #include "ray.h"
 #include "interval.h"
 #include "aabb.h"
+#include "ray_packet.h"
+#include "stats.h"
+
+#include <numeric>
+#include <vector>
 
 
 class material;
+class hittable;
 
 class hit_record {
   public:
@@ -20,6 +26,56 @@ class hit_record {
     double v;
     bool front_face;
 
+    // How p moves with u and v, filled in by finalize; zero where a shape has no such mapping.
+    vec3 dpdu, dpdv;
+
+    // How p, u and v move from one pixel to the next, from compute_differentials; all zero when
+    // the ray carries no differentials, which leaves textures unfiltered.
+    vec3 dpdx, dpdy;
+    texture_footprint footprint;
+
+    // Primitive whose attributes have not been filled in yet. During traversal primitives only
+    // record t, prim and their own (u,v) parameters; finalize computes p, normal, front_face,
+    // the texture coordinates and mat once the closest hit is known. Hittables that fill in
+    // everything during hit leave it null.
+    const hittable* prim = nullptr;
+
+    void finalize(const ray& r);
+
+    void compute_differentials(const ray_differential& rd) {
+        // Where the neighbouring pixels' rays meet the tangent plane at p gives dpdx and dpdy;
+        // expressing those in dpdu and dpdv gives the texture-space footprint (pbrt's
+        // SurfaceInteraction::ComputeDifferentials).
+        dpdx = dpdy = vec3(0,0,0);
+        footprint = texture_footprint();
+        if (!rd.valid)
+            return;
+
+        auto d = dot(normal, p);
+        auto tx = (d - dot(normal, rd.rx_origin)) / dot(normal, rd.rx_direction);
+        auto ty = (d - dot(normal, rd.ry_origin)) / dot(normal, rd.ry_direction);
+        if (!std::isfinite(tx) || !std::isfinite(ty))
+            return;
+
+        dpdx = rd.rx_origin + tx * rd.rx_direction - p;
+        dpdy = rd.ry_origin + ty * rd.ry_direction - p;
+
+        // Least squares in the two axes the normal leans on least.
+        auto nx = std::fabs(normal.x()), ny = std::fabs(normal.y()), nz = std::fabs(normal.z());
+        int a0 = 0, a1 = 1;
+        if (nx > ny && nx > nz) { a0 = 1; a1 = 2; }
+        else if (ny > nz)       { a1 = 2; }
+
+        auto det = dpdu[a0] * dpdv[a1] - dpdv[a0] * dpdu[a1];
+        if (std::fabs(det) < 1e-12)
+            return;
+
+        footprint.dudx = (dpdv[a1] * dpdx[a0] - dpdv[a0] * dpdx[a1]) / det;
+        footprint.dvdx = (dpdu[a0] * dpdx[a1] - dpdu[a1] * dpdx[a0]) / det;
+        footprint.dudy = (dpdv[a1] * dpdy[a0] - dpdv[a0] * dpdy[a1]) / det;
+        footprint.dvdy = (dpdu[a0] * dpdy[a1] - dpdu[a1] * dpdy[a0]) / det;
+    }
+
    void set_face_normal(const ray& r, const vec3& outward_normal) {
         // Sets the hit record normal vector.
         // NOTE: the parameter `outward_normal` is assumed to have unit length.
@@ -30,24 +86,141 @@ class hit_record {
 
 };
 
+// The directions a light emits into: every direction within theta_e of some direction within
+// theta_o of axis. The default, theta_o = pi, is every direction.
+class emission_cone {
+  public:
+    vec3 axis = vec3(0,0,1);
+    double cos_theta_o = -1;
+    double cos_theta_e = 0;
+};
+
+
 class hittable {
     public:
     virtual ~hittable() = default;
 
+    // Reports the closest hit in ray_t. A hit may leave its attributes pending for
+    // hit_record::finalize; a miss must leave rec untouched, so callers can pass the record of
+    // their closest hit so far.
     virtual bool hit(const ray& r,
             interval ray_t,
             hit_record& rec) const = 0;
 
+    // Fills in the attributes of a hit this object recorded with rec.prim == this.
+    virtual void finalize(const ray& r, hit_record& rec) const {}
+
     virtual aabb bounding_box() const = 0;
 
+    // Bounds at one moment of the shutter interval [0,1]. Interpolating linearly between the
+    // boxes at consecutive motion knots (k / motion_segments()) must not cut into the object,
+    // which holds whenever the object's corners move along straight lines between knots.
+    // Static objects keep the defaults.
+    virtual aabb bounding_box_at(double time) const { return bounding_box(); }
+    virtual int motion_segments() const { return 1; }
+
+    virtual aabb clipped_bounding_box(const aabb& clip) const {
+        // Bounds of the part of this object inside `clip`, for builders that split objects
+        // between BVH nodes. Flat primitives override this to clip their actual surface.
+        return intersect(bounding_box(), clip);
+    }
+
+    virtual unsigned hit_packet(ray_packet& packet, unsigned mask, hit_record recs[]) const {
+        // Intersects the lanes in `mask` and returns the lanes that hit. Each hit shrinks that
+        // lane's t_max, so later objects only report closer hits. This default traces the lanes
+        // one at a time; containers override it to test the whole packet together.
+        unsigned hits = 0;
+
+        for (int i = 0; i < ray_packet::width; i++) {
+            if (!(mask & (1u << i)))
+                continue;
+            if (hit(packet.get_ray(i), packet.get_interval(i), recs[i])) {
+                packet.t_max[i] = recs[i].t;
+                hits |= 1u << i;
+            }
+        }
+
+        return hits;
+    }
+
     virtual vec3 random(const point3& origin) const { return vec3(1,0,0); }
 
 
     virtual double pdf_value(const point3& origin, const vec3& direction) const { return 0.0; }
 
+    // Power emitted, up to a constant factor, for choosing between lights. 0 when unknown, as
+    // for a sampling target given no material.
+    virtual double light_power() const { return 0.0; }
+
+    virtual emission_cone light_cone() const { return emission_cone(); }
+
+    // Whether there is nothing to sample directions toward, as for a light list or sampler
+    // holding no lights.
+    virtual bool empty() const { return false; }
+
 };
 
 
+// Moves an object along a path of offsets spaced evenly over the shutter interval, in straight
+// lines between them: a translate that changes with ray time, for motion blur of any object
+// (a triangle, a whole mesh) along a path of several segments.
+class moving : public hittable {
+  public:
+    moving(shared_ptr<hittable> object, std::vector<vec3> path)
+      : object(object), path(std::move(path))
+    {
+        bbox = aabb::empty;
+        for (const auto& offset : this->path)
+            bbox = aabb(bbox, object->bounding_box() + offset);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        auto offset = offset_at(r.time());
+        ray offset_r(r.origin() - offset, r.direction(), r.time());
+
+        if (!object->hit(offset_r, ray_t, rec))
+            return false;
+
+        rec.finalize(offset_r);
+        rec.p += offset;
+        return true;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    aabb bounding_box_at(double time) const override {
+        return object->bounding_box_at(time) + offset_at(time);
+    }
+
+    int motion_segments() const override {
+        // A one-point path doesn't move, and counts as one segment rather than none.
+        return std::lcm(std::max(1, int(path.size()) - 1), std::max(1, object->motion_segments()));
+    }
+
+  private:
+    shared_ptr<hittable> object;
+    std::vector<vec3> path;
+    aabb bbox;
+
+    vec3 offset_at(double time) const {
+        if (path.size() == 1)
+            return path[0];
+        auto x = std::fmin(std::fmax(time, 0.0), 1.0) * (path.size() - 1);
+        auto k = std::min(size_t(x), path.size() - 2);
+        auto f = x - k;
+        return (1 - f) * path[k] + f * path[k+1];
+    }
+};
+
+
+inline void hit_record::finalize(const ray& r) {
+    if (prim) {
+        prim->finalize(r, *this);
+        prim = nullptr;
+    }
+}
+
+
 class translate : public hittable {
   public:
     translate(shared_ptr<hittable> object, const vec3& offset)
@@ -66,6 +239,9 @@ class translate : public hittable {
         if (!object->hit(offset_r, ray_t, rec))
             return false;
 
+        // The attributes are needed in object space to be moved, so fill them in now
+        rec.finalize(offset_r);
+
         // Move the intersection point forwards by the offset
         rec.p += offset;
 
@@ -75,6 +251,12 @@ class translate : public hittable {
 
     aabb bounding_box() const override { return bbox; }
 
+    aabb bounding_box_at(double time) const override {
+        return object->bounding_box_at(time) + offset;
+    }
+
+    int motion_segments() const override { return object->motion_segments(); }
+
   private:
     shared_ptr<hittable> object;
     vec3 offset;
@@ -87,8 +269,11 @@ class rotate_y : public hittable {
         auto radians = degrees_to_radians(angle);
         sin_theta = std::sin(radians);
         cos_theta = std::cos(radians);
-        bbox = object->bounding_box();
+        bbox = rotated(object->bounding_box());
+    }
 
+    aabb rotated(const aabb& bbox) const {
+        // The box around bbox once rotated into world space.
         point3 min( infinity,  infinity,  infinity);
         point3 max(-infinity, -infinity, -infinity);
 
@@ -112,7 +297,7 @@ class rotate_y : public hittable {
             }
         }
 
-        bbox = aabb(min, max);
+        return aabb(min, max);
     }
 
 
@@ -139,6 +324,8 @@ class rotate_y : public hittable {
         if (!object->hit(rotated_r, ray_t, rec))
             return false;
 
+        rec.finalize(rotated_r);
+
         // Transform the intersection from object space back to world space.
 
         rec.p = point3(
@@ -147,22 +334,34 @@ class rotate_y : public hittable {
             (-sin_theta * rec.p.x()) + (cos_theta * rec.p.z())
         );
 
-        rec.normal = vec3(
-            (cos_theta * rec.normal.x()) + (sin_theta * rec.normal.z()),
-            rec.normal.y(),
-            (-sin_theta * rec.normal.x()) + (cos_theta * rec.normal.z())
-        );
+        rec.normal = to_world(rec.normal);
+        rec.dpdu = to_world(rec.dpdu);
+        rec.dpdv = to_world(rec.dpdv);
 
         return true;
     }
 
     aabb bounding_box() const override { return bbox; }
 
+    aabb bounding_box_at(double time) const override {
+        // A rotated box's min is the least of its moving corners, a concave function of time,
+        // so it never drops below the interpolation between knots; likewise for the max.
+        return rotated(object->bounding_box_at(time));
+    }
+
+    int motion_segments() const override { return object->motion_segments(); }
+
     private:
         shared_ptr<hittable> object;
         double sin_theta;
         double cos_theta;
         aabb bbox;
+
+        vec3 to_world(const vec3& v) const {
+            return vec3((cos_theta * v.x()) + (sin_theta * v.z()),
+                        v.y(),
+                        (-sin_theta * v.x()) + (cos_theta * v.z()));
+        }
 };
 
 #endif
@@ -7,7 +7,9 @@
 #include "interval.h"
 #include "onb.h"
 
+#include <algorithm>
 #include <memory>
+#include <numeric>
 #include <vector>
 
 
@@ -29,26 +31,53 @@ class hittable_list : public hittable {
     bool hit(const ray& r, 
             interval ray_t, 
             hit_record& rec) const override {
-        hit_record temp_rec;
+        // Misses leave rec alone, so each object can write straight into it.
         bool hit_anything = false;
         auto closest_so_far = ray_t.max;
 
         for (const auto& object : objects) {
             if (object->hit(r, 
                         interval(ray_t.min, closest_so_far),
-                        temp_rec)) 
+                        rec)) 
             {
                 hit_anything = true;
-                closest_so_far = temp_rec.t;
-                rec = temp_rec;
+                closest_so_far = rec.t;
             }
         }
 
         return hit_anything;
     }
 
+    unsigned hit_packet(ray_packet& packet, unsigned mask, hit_record recs[]) const override {
+        unsigned hits = 0;
+        for (const auto& object : objects)
+            hits |= object->hit_packet(packet, mask, recs);
+        return hits;
+    }
+
     aabb bounding_box() const override { return bbox; }
 
+    bool empty() const override { return objects.empty(); }
+
+    aabb bounding_box_at(double time) const override {
+        aabb box = aabb::empty;
+        for (const auto& object : objects)
+            box = aabb(box, object->bounding_box_at(time));
+        return box;
+    }
+
+    int motion_segments() const override {
+        // Capped, so paths of coprime lengths can't overflow the multiple; motion_bvh caps its
+        // own count far lower anyway.
+        const long long max_segments = 1 << 20;
+        long long segments = 1;
+        for (const auto& object : objects) {
+            long long m = std::max(1, object->motion_segments());
+            segments = std::min(std::lcm(segments, m), max_segments);
+        }
+        return int(segments);
+    }
+
 
     double pdf_value(const point3& origin, const vec3& direction) const override {
         auto weight = 1.0 / objects.size();
@@ -60,6 +89,17 @@ class hittable_list : public hittable {
         return sum;
     }
 
+    double light_power() const override {
+        auto sum = 0.0;
+        for (const auto& object : objects) {
+            auto power = object->light_power();
+            if (power <= 0)
+                return 0;
+            sum += power;
+        }
+        return sum;
+    }
+
     vec3 random(const point3& origin) const override {
         auto int_size = int(objects.size());
         return objects[random_int(0, int_size-1)]->random(origin);
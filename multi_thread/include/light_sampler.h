@@ -0,0 +1,199 @@
+#ifndef LIGHT_SAMPLER_H
+#define LIGHT_SAMPLER_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+
+// Twice the center of a light's bounds along axis, the key light BVHs split their lights on.
+inline double light_center_key(const hittable& light, int axis) {
+    auto ax = light.bounding_box().axis_interval(axis);  // A copy; the box is a temporary
+    return ax.min + ax.max;
+}
+
+
+// Stands in for a scene's light list when sampling directions toward lights. Instead of
+// choosing a light uniformly, as hittable_list does, it chooses in proportion to light_power()
+// through Walker's alias table: one random number, one table lookup, whatever the light count.
+// Lights whose power is unknown get the mean of the others.
+//
+// The matching pdf sums each light's pdf weighted by its probability, but a light can only
+// contribute along directions that reach its bounding box. The boxes sit in a small BVH, so a
+// direction pays for the lights it passes near instead of a hit() against every one.
+class light_sampler : public hittable {
+  public:
+    light_sampler(const hittable_list& lights) : lights(lights.objects) {
+        if (this->lights.empty())
+            return;
+
+        std::vector<double> power(this->lights.size());
+        for (size_t i = 0; i < power.size(); i++)
+            power[i] = this->lights[i]->light_power();
+        build_alias_table(power);
+        build_tree();
+    }
+
+    // Chooses light i in proportion to weights[i] instead of its power.
+    light_sampler(const std::vector<shared_ptr<hittable>>& lights, std::vector<double> weights)
+      : lights(lights)
+    {
+        if (this->lights.empty())
+            return;
+
+        build_alias_table(weights);
+        build_tree();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override { return false; }
+
+    aabb bounding_box() const override { return nodes.empty() ? aabb::empty : nodes[0].box; }
+
+    bool empty() const override { return lights.empty(); }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        if (nodes.empty())
+            return 0;
+
+        ray r(origin, direction);
+        interval ray_t(0.001, infinity);
+        auto sum = 0.0;
+
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            const auto& n = nodes[stack[--top]];
+            if (!n.box.hit(r, ray_t))
+                continue;
+
+            if (n.light >= 0) {
+                sum += probability[n.light] * lights[n.light]->pdf_value(origin, direction);
+            } else {
+                stack[top++] = n.left;
+                stack[top++] = n.right;
+            }
+        }
+
+        return sum;
+    }
+
+    vec3 random(const point3& origin) const override {
+        if (lights.empty())
+            return vec3(1,0,0);
+
+        // The integer part of one uniform picks a column, the fraction decides between the
+        // column's own light and its alias.
+        auto x = random_double() * lights.size();
+        auto column = std::min(size_t(x), lights.size() - 1);
+        auto light = x - column < threshold[column] ? column : alias[column];
+        return lights[light]->random(origin);
+    }
+
+    // The chance that random() picks light i.
+    double light_probability(size_t i) const { return probability[i]; }
+
+  private:
+    class node {
+      public:
+        aabb box;
+        int left = -1;
+        int right = -1;
+        int light = -1;
+    };
+
+    std::vector<shared_ptr<hittable>> lights;
+    std::vector<double> probability;
+    std::vector<double> threshold;
+    std::vector<size_t> alias;
+    std::vector<node> nodes;
+
+    void build_tree() {
+        std::vector<int> order(lights.size());
+        std::iota(order.begin(), order.end(), 0);
+        build(order, 0, order.size());
+    }
+
+    void build_alias_table(std::vector<double> power) {
+        auto n = lights.size();
+
+        double known_sum = 0;
+        size_t known = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (power[i] > 0) {
+                known_sum += power[i];
+                known++;
+            }
+        }
+        auto fallback = known ? known_sum / known : 1.0;
+        for (auto& p : power)
+            if (!(p > 0)) p = fallback;
+
+        auto total = std::accumulate(power.begin(), power.end(), 0.0);
+        probability.resize(n);
+        for (size_t i = 0; i < n; i++)
+            probability[i] = power[i] / total;
+
+        // Vose's construction: columns below the average are topped up from those above it.
+        threshold.resize(n);
+        alias.resize(n);
+        std::vector<size_t> small, large;
+        std::vector<double> scaled(n);
+        for (size_t i = 0; i < n; i++) {
+            scaled[i] = probability[i] * n;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+
+        while (!small.empty() && !large.empty()) {
+            auto s = small.back(); small.pop_back();
+            auto l = large.back();
+            threshold[s] = scaled[s];
+            alias[s] = l;
+            scaled[l] -= 1 - scaled[s];
+            if (scaled[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        // Whatever is left is 1 up to rounding.
+        for (auto i : large) { threshold[i] = 1; alias[i] = i; }
+        for (auto i : small) { threshold[i] = 1; alias[i] = i; }
+    }
+
+    int build(std::vector<int>& order, size_t start, size_t end) {
+        int index = int(nodes.size());
+        nodes.emplace_back();
+
+        aabb span = aabb::empty;
+        for (size_t i = start; i < end; i++)
+            span = aabb(span, lights[order[i]]->bounding_box());
+        nodes[index].box = span;
+
+        if (end - start == 1) {
+            nodes[index].light = order[start];
+            return index;
+        }
+
+        int axis = span.longest_axis();
+        auto mid = start + (end - start) / 2;
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                         [&](int a, int b) {
+                             return light_center_key(*lights[a], axis)
+                                  < light_center_key(*lights[b], axis);
+                         });
+
+        auto left = build(order, start, mid);
+        auto right = build(order, mid, end);
+        nodes[index].left = left;
+        nodes[index].right = right;
+        return index;
+    }
+};
+
+#endif
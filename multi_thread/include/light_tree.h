@@ -0,0 +1,316 @@
+#ifndef LIGHT_TREE_H
+#define LIGHT_TREE_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "light_sampler.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+
+// A BVH over a scene's lights for sampling directions toward them, after Conty Estevez and
+// Kulla's many-light sampling. Each node keeps its lights' bounds, total power and the cone of
+// directions they emit into. From a shading point, a node's importance is its power over the
+// squared distance, scaled by how directly it can face the point; a node that can't emit
+// toward the point at all gets none. Sampling walks one path from the root, taking each child
+// in proportion to its importance, so choosing a light costs log n importance evaluations and
+// favors the near, bright and facing ones.
+//
+// The pdf of a direction is the sum over lights it reaches of the chance of reaching that
+// light's leaf times the light's own pdf. Those chances are products along the same path, so
+// one traversal of the nodes whose boxes the direction passes through collects them all.
+//
+// Where neither child has importance both are taken evenly, so every light keeps a nonzero
+// chance wherever its pdf is evaluated: sampling and pdf always agree.
+class light_tree : public hittable {
+  public:
+    light_tree(const hittable_list& lights) : lights(lights.objects) {
+        trace_scope trace("light tree build", "build");
+
+        if (this->lights.empty())
+            return;
+
+        // Lights with unknown power get the mean of the others, as in light_sampler.
+        std::vector<double> power(this->lights.size());
+        double known_sum = 0;
+        size_t known = 0;
+        for (size_t i = 0; i < power.size(); i++) {
+            power[i] = this->lights[i]->light_power();
+            if (power[i] > 0) {
+                known_sum += power[i];
+                known++;
+            }
+        }
+        auto fallback = known ? known_sum / known : 1.0;
+        for (auto& p : power)
+            if (!(p > 0)) p = fallback;
+
+        std::vector<int> order(this->lights.size());
+        std::iota(order.begin(), order.end(), 0);
+        build(order, 0, order.size(), power);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override { return false; }
+
+    aabb bounding_box() const override { return nodes.empty() ? aabb::empty : nodes[0].box; }
+
+    bool empty() const override { return lights.empty(); }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        if (nodes.empty())
+            return 0;
+
+        ray r(origin, direction);
+        interval ray_t(0.001, infinity);
+        auto sum = 0.0;
+
+        // Entries are nodes whose boxes the direction is known to reach. Children are tested
+        // before their importances are worked out, which most nodes then never need.
+        struct entry { int node; double pmf; };
+        entry stack[64];
+        int top = 0;
+        if (nodes[0].box.hit(r, ray_t))
+            stack[top++] = {0, 1.0};
+
+        while (top > 0) {
+            auto current = stack[--top];
+            const auto& n = nodes[current.node];
+
+            if (n.light >= 0) {
+                sum += current.pmf * lights[n.light]->pdf_value(origin, direction);
+                continue;
+            }
+
+            bool reach_left = nodes[n.left].box.hit(r, ray_t);
+            bool reach_right = nodes[n.right].box.hit(r, ray_t);
+            if (!reach_left && !reach_right)
+                continue;
+
+            auto p_left = left_probability(n, origin);
+            if (reach_left && p_left > 0)
+                stack[top++] = {n.left, current.pmf * p_left};
+            if (reach_right && p_left < 1)
+                stack[top++] = {n.right, current.pmf * (1 - p_left)};
+        }
+
+        return sum;
+    }
+
+    vec3 random(const point3& origin) const override {
+        if (nodes.empty())
+            return vec3(1,0,0);
+
+        int index = 0;
+        while (nodes[index].light < 0) {
+            const auto& n = nodes[index];
+            index = random_double() < left_probability(n, origin) ? n.left : n.right;
+        }
+        return lights[nodes[index].light]->random(origin);
+    }
+
+    // The chance that random() from origin picks light i.
+    double light_probability(const point3& origin, size_t i) const {
+        for (size_t k = 0; k < nodes.size(); k++)
+            if (nodes[k].light == int(i))
+                return path_probability(int(k), origin);
+        return 0;
+    }
+
+  private:
+    class node {
+      public:
+        aabb box;
+        point3 center;
+        double radius = 0;     // Of the sphere around box
+        double power = 0;
+        emission_cone cone;
+        double sin_theta_o = 0;
+        int left = -1;
+        int right = -1;
+        int parent = -1;
+        int light = -1;        // Index into lights, for a leaf
+
+        double importance(const point3& p) const {
+            // Bounds the cosine between the emission cone and the direction to p, the way
+            // pbrt's LightBounds::Importance does, by widening the cone by theta_o and by the
+            // angle the node's bounding sphere subtends from p.
+            auto to_p = p - center;
+            auto d2 = to_p.length_squared();
+
+            // Points inside the bounds would see an infinite power density; cap it at the
+            // node's own size.
+            auto falloff = power / std::fmax(d2, std::fmax(radius * radius, 1e-8));
+
+            // Omnidirectional nodes, which is most of them above the leaves, face every point.
+            if (cone.cos_theta_o <= -1 || d2 == 0)
+                return falloff;
+
+            auto cos_w = dot(cone.axis, to_p / std::sqrt(d2));
+            auto sin_w = safe_sqrt(1 - cos_w * cos_w);
+
+            auto cos_x = cos_sub_clamped(sin_w, cos_w, sin_theta_o, cone.cos_theta_o);
+            auto sin_x = sin_sub_clamped(sin_w, cos_w, sin_theta_o, cone.cos_theta_o);
+
+            double cos_b = -1, sin_b = 0;
+            if (d2 > radius * radius) {
+                auto sin2_b = radius * radius / d2;
+                sin_b = std::sqrt(sin2_b);
+                cos_b = safe_sqrt(1 - sin2_b);
+            }
+
+            auto cos_p = cos_sub_clamped(sin_x, cos_x, sin_b, cos_b);
+            if (cos_p <= cone.cos_theta_e)
+                return 0;
+
+            return falloff * cos_p;
+        }
+    };
+
+    std::vector<shared_ptr<hittable>> lights;
+    std::vector<node> nodes;
+
+    static double safe_sqrt(double x) { return std::sqrt(std::fmax(0.0, x)); }
+
+    static double cos_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+        // cos(max(0, a - b))
+        return cos_a > cos_b ? 1 : cos_a * cos_b + sin_a * sin_b;
+    }
+
+    static double sin_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+        // sin(max(0, a - b))
+        return cos_a > cos_b ? 0 : sin_a * cos_b - cos_a * sin_b;
+    }
+
+    static double angle_between(const vec3& a, const vec3& b) {
+        // From the chord between the unit vectors rather than acos of their dot product, which
+        // loses the angle near 0 and pi: a normal a rounding off unit length would otherwise
+        // be some 1e-8 from itself, and a cone merged with its own copy every direction.
+        if (dot(a, b) < 0)
+            return pi - 2 * std::asin(std::fmin(1.0, (a + b).length() / 2));
+        return 2 * std::asin(std::fmin(1.0, (b - a).length() / 2));
+    }
+
+    static vec3 rotate(const vec3& v, const vec3& axis, double angle) {
+        // Rodrigues' rotation of v about the unit vector axis.
+        auto c = std::cos(angle), s = std::sin(angle);
+        return v * c + cross(axis, v) * s + axis * (dot(axis, v) * (1 - c));
+    }
+
+    static emission_cone merge(const emission_cone& a, const emission_cone& b) {
+        // The narrowest cone around both, from pbrt's DirectionCone Union.
+        emission_cone result;
+        result.cos_theta_e = std::fmin(a.cos_theta_e, b.cos_theta_e);
+
+        auto theta_a = std::acos(std::clamp(a.cos_theta_o, -1.0, 1.0));
+        auto theta_b = std::acos(std::clamp(b.cos_theta_o, -1.0, 1.0));
+        auto theta_d = angle_between(a.axis, b.axis);
+
+        if (std::fmin(theta_d + theta_b, pi) <= theta_a) {
+            result.axis = a.axis;
+            result.cos_theta_o = a.cos_theta_o;
+            return result;
+        }
+        if (std::fmin(theta_d + theta_a, pi) <= theta_b) {
+            result.axis = b.axis;
+            result.cos_theta_o = b.cos_theta_o;
+            return result;
+        }
+
+        auto theta_o = (theta_a + theta_d + theta_b) / 2;
+        auto spin = cross(a.axis, b.axis);
+        if (theta_o >= pi || spin.length_squared() == 0)
+            return result;  // Every direction
+
+        result.axis = unit_vector(rotate(a.axis, unit_vector(spin), theta_o - theta_a));
+        result.cos_theta_o = std::cos(theta_o);
+        return result;
+    }
+
+    double left_probability(const node& n, const point3& origin) const {
+        auto left = nodes[n.left].importance(origin);
+        auto right = nodes[n.right].importance(origin);
+        return left + right > 0 ? left / (left + right) : 0.5;
+    }
+
+    double path_probability(int index, const point3& origin) const {
+        double pmf = 1;
+        for (int child = index, parent = nodes[index].parent; parent >= 0;
+             child = parent, parent = nodes[parent].parent) {
+            auto p_left = left_probability(nodes[parent], origin);
+            pmf *= nodes[parent].left == child ? p_left : 1 - p_left;
+        }
+        return pmf;
+    }
+
+    int build(std::vector<int>& order, size_t start, size_t end, const std::vector<double>& power) {
+        // Median splits along the longest axis of the lights' bounds, as bvh_node does. Returns
+        // the node index.
+        int index = int(nodes.size());
+        nodes.emplace_back();
+
+        if (end - start == 1) {
+            auto i = order[start];
+            auto& n = nodes[index];
+            n.light = i;
+            n.box = lights[i]->bounding_box();
+            n.power = power[i];
+            n.cone = lights[i]->light_cone();
+            set_sphere(n);
+            return index;
+        }
+
+        aabb span = aabb::empty;
+        for (size_t i = start; i < end; i++)
+            span = aabb(span, lights[order[i]]->bounding_box());
+
+        int axis = span.longest_axis();
+        auto mid = start + (end - start) / 2;
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                         [&](int a, int b) {
+                             return light_center_key(*lights[a], axis)
+                                  < light_center_key(*lights[b], axis);
+                         });
+
+        auto left = build(order, start, mid, power);
+        auto right = build(order, mid, end, power);
+
+        auto& n = nodes[index];
+        n.left = left;
+        n.right = right;
+        n.box = span;
+        n.power = nodes[left].power + nodes[right].power;
+        n.cone = merge(nodes[left].cone, nodes[right].cone);
+        set_sphere(n);
+        nodes[left].parent = index;
+        nodes[right].parent = index;
+        return index;
+    }
+
+    static void set_sphere(node& n) {
+        n.center = point3((n.box.x.min + n.box.x.max) / 2,
+                          (n.box.y.min + n.box.y.max) / 2,
+                          (n.box.z.min + n.box.z.max) / 2);
+        n.radius = vec3(n.box.x.size(), n.box.y.size(), n.box.z.size()).length() / 2;
+        n.sin_theta_o = safe_sqrt(1 - n.cone.cos_theta_o * n.cone.cos_theta_o);
+    }
+};
+
+
+
+// What to sample a light list through. A few lights are picked between by power alone; past
+// that, the tree's per-point importance is worth its traversal. (For a couple of lights, the
+// distance weighting can even hurt: a sampling target such as the Cornell box's glass sphere
+// sits close to most surfaces but sends them little light.)
+inline std::unique_ptr<hittable> make_light_sampler(const hittable_list& lights) {
+    if (lights.objects.size() > 32)
+        return std::make_unique<light_tree>(lights);
+    return std::make_unique<light_sampler>(lights);
+}
+
+#endif
@@ -14,13 +14,59 @@ class scatter_record {
     shared_ptr<pdf> pdf_ptr;
     bool skip_pdf;
     ray skip_pdf_ray;
+    // Where skip_pdf_ray passed through the surface, the index of refraction on the side it
+    // arrived from over the index on the side it left into.
+    double eta = 1;
 };
 
 
+// The differentials of a skip_pdf_ray, from those of the ray that arrived: pbrt's
+// SpecularReflect and SpecularTransmit, with the normal taken as constant across the footprint.
+// On curved mirrors this understates how fast the footprint grows, which errs toward sharper
+// rather than blurrier reflections. Needs rec.compute_differentials to have run.
+inline ray_differential specular_differential(const ray& r_in, const hit_record& rec,
+                                              const scatter_record& srec, const ray_differential& rd)
+{
+    ray_differential out;
+    if (!rd.valid)
+        return out;
+
+    auto wo = -unit_vector(r_in.direction());
+    auto wi = unit_vector(srec.skip_pdf_ray.direction());
+    const auto& n = rec.normal;  // On wo's side
+    auto dwodx = -rd.rx_direction - wo;
+    auto dwody = -rd.ry_direction - wo;
+
+    out.valid = true;
+    out.rx_origin = rec.p + rec.dpdx;
+    out.ry_origin = rec.p + rec.dpdy;
+
+    if (dot(wi, n) > 0) {
+        out.rx_direction = unit_vector(wi - dwodx + 2 * dot(dwodx, n) * n);
+        out.ry_direction = unit_vector(wi - dwody + 2 * dot(dwody, n) * n);
+    } else {
+        // wi = -eta wo + (eta cos_i - cos_t) n, differentiated.
+        auto eta = srec.eta;
+        auto cos_i = dot(wo, n);
+        auto cos_t = -dot(wi, n);
+        auto k = cos_t > 0 ? eta - eta * eta * cos_i / cos_t : 0;
+        out.rx_direction = unit_vector(wi - eta * dwodx + k * dot(dwodx, n) * n);
+        out.ry_direction = unit_vector(wi - eta * dwody + k * dot(dwody, n) * n);
+    }
+    return out;
+}
+
+
+// Which material class a hit landed on, so that the wavefront integrator can shade all hits of
+// one kind together.
+enum class material_kind { lambertian, metal, dielectric, isotropic, diffuse_light, other };
+
 class material {
     public:
         virtual ~material() = default;
 
+        virtual material_kind kind() const { return material_kind::other; }
+
         virtual bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, double& pdf
         ) const {
@@ -38,6 +84,9 @@ class material {
             return 0;
         }
 
+        // Typical radiance emitted, for weighting lights by power.
+        virtual color average_emission() const { return color(0,0,0); }
+
         virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) 
         const {
             return false;
@@ -51,8 +100,10 @@ class lambertian : public material {
     lambertian(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
     lambertian(shared_ptr<texture> tex) : tex(tex) {}
 
+    material_kind kind() const override { return material_kind::lambertian; }
+
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
-        srec.attenuation = tex->value(rec.u, rec.v, rec.p);
+        srec.attenuation = tex->filtered_value(rec.u, rec.v, rec.p, rec.footprint);
         srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
         srec.skip_pdf = false;
         return true;
@@ -75,6 +126,8 @@ class metal : public material {
   public:
     metal(const color& albedo, double fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
 
+    material_kind kind() const override { return material_kind::metal; }
+
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
         vec3 reflected = reflect(r_in.direction(), rec.normal);
         reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
@@ -98,6 +151,8 @@ class dielectric : public material {
     public:
         dielectric(double refraction_index) : refraction_index(refraction_index) {}
 
+        material_kind kind() const override { return material_kind::dielectric; }
+
 
         bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
             srec.attenuation = color(1.0, 1.0, 1.0);
@@ -115,8 +170,10 @@ class dielectric : public material {
 
             if (cannot_refract || reflectance(cos_theta, ri) > random_double())
                 direction = reflect(unit_direction, rec.normal);
-            else
+            else {
                 direction = refract(unit_direction, rec.normal, ri);
+                srec.eta = ri;
+            }
 
 
             srec.skip_pdf_ray = ray(rec.p, direction, r_in.time());
@@ -139,12 +196,16 @@ class diffuse_light : public material {
     diffuse_light(shared_ptr<texture> tex) : tex(tex) {}
     diffuse_light(const color& emit) : tex(make_shared<solid_color>(emit)) {}
 
+    material_kind kind() const override { return material_kind::diffuse_light; }
+
+    color average_emission() const override { return tex->value(0.5, 0.5, point3(0,0,0)); }
+
    
    color emitted(const ray& r_in, const hit_record& rec, double u, double v, const point3& p)
     const override {
         if (!rec.front_face)
             return color(0,0,0);
-        return tex->value(u, v, p);
+        return tex->filtered_value(u, v, p, rec.footprint);
     }
 
 
@@ -157,6 +218,8 @@ class isotropic : public material {
     isotropic(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
     isotropic(shared_ptr<texture> tex) : tex(tex) {}
 
+    material_kind kind() const override { return material_kind::isotropic; }
+
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
         srec.attenuation = tex->value(rec.u, rec.v, rec.p);
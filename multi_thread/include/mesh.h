@@ -2,14 +2,20 @@
 #define MESH_H
 
 #include "hittable.h"
+#include "light_sampler.h"
 #include "triangle.h"
+#include "trace.h"
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <vector>
 
 class mesh : public hittable {
 public:
     mesh(const std::string& filename, shared_ptr<material> mat) {
+        trace_scope trace("mesh load", "load");
+
         std::vector<point3> vertices;
         std::ifstream file(filename);
         
@@ -54,15 +60,13 @@ public:
     }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        hit_record temp_rec;
         bool hit_anything = false;
         auto closest_so_far = ray_t.max;
 
         for (const auto& tri : triangles) {
-            if (tri->hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+            if (tri->hit(r, interval(ray_t.min, closest_so_far), rec)) {
                 hit_anything = true;
-                closest_so_far = temp_rec.t;
-                rec = temp_rec;
+                closest_so_far = rec.t;
             }
         }
 
@@ -71,10 +75,43 @@ public:
 
     aabb bounding_box() const override { return bbox; }
 
+    const std::vector<shared_ptr<triangle>>& faces() const { return triangles; }
+
+    // As a light, the mesh picks a triangle in proportion to its area and samples that.
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        return area_sampler().pdf_value(origin, direction);
+    }
+
+    vec3 random(const point3& origin) const override {
+        return area_sampler().random(origin);
+    }
+
+    double light_power() const override {
+        double power = 0;
+        for (const auto& tri : triangles)
+            power += tri->light_power();
+        return power;
+    }
+
 private:
     std::vector<shared_ptr<triangle>> triangles;
     aabb bbox;
 
+    // Built on first use, since most meshes are never sampled as lights.
+    mutable std::once_flag sampler_built;
+    mutable std::unique_ptr<light_sampler> sampler;
+
+    const light_sampler& area_sampler() const {
+        std::call_once(sampler_built, [this] {
+            std::vector<shared_ptr<hittable>> faces(triangles.begin(), triangles.end());
+            std::vector<double> areas;
+            for (const auto& tri : triangles)
+                areas.push_back(tri->surface_area());
+            sampler = std::make_unique<light_sampler>(faces, areas);
+        });
+        return *sampler;
+    }
+
     void set_bounding_box() {
         if (triangles.empty()) return;
 
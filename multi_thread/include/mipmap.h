@@ -0,0 +1,227 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include "color.h"
+#include "ray.h"
+#include "rtw_stb_image.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+
+// An image and its successively halved copies, down to a single texel, each built by averaging
+// 2x2 blocks of the one above it. A lookup covering many texels of the full image reads a few
+// texels of the level where one texel is about that size instead, which both removes the
+// aliasing of point-sampling a detailed image from far away and keeps distant lookups in a
+// small, cache-friendly block of memory.
+//
+// Texels are kept as 8-bit linear values, like rtw_image's byte data, padded to four bytes
+// each. By default each level is laid out in 4x4 tiles of 64 bytes, one cache line apiece, so a
+// texel's neighbours above and below are usually in the same line as those beside it: a
+// bilinear lookup mostly touches one line instead of two rows' worth, and lookups scattered
+// across a small region of a large image share lines instead of each pulling in a row. The
+// tiles are in turn grouped 8x8 into 4 KiB blocks of 32x32 texels, a page apiece, so such a
+// region also shares address translations.
+enum class texel_layout { scanline, tiled };
+
+class mipmap {
+  public:
+    mipmap(const rtw_image& image, texel_layout layout = texel_layout::tiled) : layout(layout) {
+        trace_scope trace("mipmap build", "load");
+
+        int w = image.width();
+        int h = image.height();
+        if (w == 0 || h == 0)
+            return;
+
+        // Each level is averaged from the float values of the one above, so rounding to bytes
+        // doesn't accumulate down the pyramid. The full image's values are read in place; only
+        // the smaller levels' are copied, a third of its size at most.
+        const float* above = image.float_pixel_data(0, 0);  // Rows are contiguous
+        add_level(w, h, above);
+
+        std::vector<float> storage;
+        while (w > 1 || h > 1) {
+            int nw = std::max(1, w / 2);
+            int nh = std::max(1, h / 2);
+            std::vector<float> below(size_t(nw) * nh * 3);
+
+            // Each texel averages a 2x2 block. Along an odd side the last texel's block takes in
+            // the leftover row or column too, 3 wide, so no texel goes unsampled; a side of 1
+            // stays 1.
+            auto span = [](int k, int n, int size) {
+                if (size == 1) return std::pair<int,int>(0, 0);
+                return std::pair<int,int>(2*k, k == n - 1 && size % 2 == 1 ? 2*k + 2 : 2*k + 1);
+            };
+            for (int j = 0; j < nh; j++) {
+                auto [j0, j1] = span(j, nh, h);
+                for (int i = 0; i < nw; i++) {
+                    auto [i0, i1] = span(i, nw, w);
+                    auto scale = 1.0f / ((i1 - i0 + 1) * (j1 - j0 + 1));
+                    for (int c = 0; c < 3; c++) {
+                        float sum = 0;
+                        for (int y = j0; y <= j1; y++)
+                            for (int x = i0; x <= i1; x++)
+                                sum += above[(size_t(y) * w + x) * 3 + c];
+                        below[(size_t(j) * nw + i) * 3 + c] = scale * sum;
+                    }
+                }
+            }
+
+            add_level(nw, nh, below.data());
+            storage.swap(below);
+            above = storage.data();
+            w = nw;
+            h = nh;
+        }
+    }
+
+    bool empty() const { return levels.empty(); }
+    int level_count() const { return int(levels.size()); }
+
+    // The texel of the full-resolution image containing (u,v), with v = 0 at the top row.
+    color nearest(double u, double v) const {
+        const auto& l = levels[0];
+        return texel(l, int(u * l.width), int(v * l.height));
+    }
+
+    // The average over a footprint, in (u,v) as fractions of the image's width and height.
+    // Footprints stretched along one direction, as on surfaces seen edge-on, are covered by up
+    // to max_anisotropy probes spaced along their long axis, each at the level matching the
+    // short axis, rather than one probe blurred to the long axis's size (after GPU anisotropic
+    // filtering; past that ratio the level is raised to cover the rest).
+    color filtered(double u, double v, const texture_footprint& footprint) const {
+        const int max_anisotropy = 8;
+
+        auto w = levels[0].width, h = levels[0].height;
+        auto ax = footprint.dudx * w, ay = footprint.dvdx * h;
+        auto bx = footprint.dudy * w, by = footprint.dvdy * h;
+        auto a = std::sqrt(ax*ax + ay*ay);
+        auto b = std::sqrt(bx*bx + by*by);
+
+        // The major axis, in (u,v), and both lengths in texels.
+        double major_u, major_v, major, minor;
+        if (a >= b) { major_u = footprint.dudx; major_v = footprint.dvdx; major = a; minor = b; }
+        else        { major_u = footprint.dudy; major_v = footprint.dvdy; major = b; minor = a; }
+        minor = std::fmax(minor, major / max_anisotropy);
+
+        auto level = std::log2(std::fmax(minor, 1e-8));
+        auto probes = std::clamp(int(std::ceil(major / std::fmax(minor, 1e-8))), 1, max_anisotropy);
+        if (probes == 1)
+            return trilinear(u, v, level);
+
+        color sum(0,0,0);
+        for (int k = 0; k < probes; k++) {
+            auto t = (k + 0.5) / probes - 0.5;
+            sum += trilinear(u + t * major_u, v + t * major_v, level);
+        }
+        return sum / probes;
+    }
+
+    // Bytes of texel storage over all levels.
+    size_t memory_bytes() const {
+        size_t bytes = 0;
+        for (const auto& l : levels)
+            bytes += l.lines.size() * sizeof(cache_line);
+        return bytes;
+    }
+
+  private:
+    static const int tile_size = 4;    // Texels on a side; 16 RGBA texels fill a cache line
+    static const int block_size = 32;  // Texels on a side; 64 tiles fill a 4 KiB page
+
+    class alignas(64) cache_line {
+      public:
+        unsigned char bytes[64];
+    };
+
+    class level_data {
+      public:
+        int width, height;
+        int blocks_across;              // For the tiled layout
+        std::vector<cache_line> lines;  // RGBA texels, in rows or in blocks of tiles
+
+        // Where texel (i,j) starts, in bytes from the first line.
+        size_t offset(int i, int j, texel_layout layout) const {
+            if (layout == texel_layout::scanline)
+                return (size_t(j) * width + i) * 4;
+
+            // Unsigned, so the divisions are shifts.
+            unsigned x = i, y = j;
+            auto block = size_t(y / block_size) * blocks_across + x / block_size;
+            auto tile = (y % block_size / tile_size) * (block_size / tile_size)
+                      + (x % block_size / tile_size);
+            auto texel = (y % tile_size) * tile_size + x % tile_size;
+            return block * 4096 + tile * 64 + texel * 4;
+        }
+    };
+
+    texel_layout layout;
+    std::vector<level_data> levels;
+
+    color trilinear(double u, double v, double level) const {
+        // Bilinear lookups on the two levels around a fractional level, blended.
+        if (level <= 0)
+            return bilinear(levels[0], u, v);
+        if (level >= level_count() - 1)
+            return bilinear(levels.back(), u, v);
+
+        auto coarse = int(level);
+        auto f = level - coarse;
+        return (1 - f) * bilinear(levels[coarse], u, v) + f * bilinear(levels[coarse + 1], u, v);
+    }
+
+    void add_level(int w, int h, const float* values) {
+        level_data l;
+        l.width = w;
+        l.height = h;
+        l.blocks_across = (w + block_size - 1) / block_size;
+
+        auto texels = layout == texel_layout::tiled
+                    ? size_t(l.blocks_across) * ((h + block_size - 1) / block_size) * block_size * block_size
+                    : size_t(w) * h;
+        l.lines.resize((texels * 4 + 63) / 64);
+
+        // Each row is converted in one pass and then spread into its texels.
+        std::vector<unsigned char> row(size_t(w) * 3);
+        for (int j = 0; j < h; j++) {
+            rtw_image::float_to_bytes(values + size_t(j) * w * 3, row.data(), row.size());
+            for (int i = 0; i < w; i++) {
+                auto* t = &l.lines[0].bytes[0] + l.offset(i, j, layout);
+                t[0] = row[3*i];
+                t[1] = row[3*i + 1];
+                t[2] = row[3*i + 2];
+                t[3] = 255;
+            }
+        }
+
+        levels.push_back(std::move(l));
+    }
+
+    color texel(const level_data& l, int i, int j) const {
+        i = std::clamp(i, 0, l.width - 1);
+        j = std::clamp(j, 0, l.height - 1);
+        const auto* t = &l.lines[0].bytes[0] + l.offset(i, j, layout);
+
+        auto color_scale = 1.0 / 255.0;
+        return color(color_scale*t[0], color_scale*t[1], color_scale*t[2]);
+    }
+
+    color bilinear(const level_data& l, double u, double v) const {
+        // Texel centers sit at half-integer coordinates.
+        auto x = u * l.width - 0.5;
+        auto y = v * l.height - 0.5;
+        auto i = int(std::floor(x));
+        auto j = int(std::floor(y));
+        auto fx = x - i;
+        auto fy = y - j;
+
+        return (1 - fx) * (1 - fy) * texel(l, i, j)     + fx * (1 - fy) * texel(l, i + 1, j)
+             + (1 - fx) * fy       * texel(l, i, j + 1) + fx * fy       * texel(l, i + 1, j + 1);
+    }
+};
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef MOTION_BVH_H
+#define MOTION_BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+
+// A BVH for scenes with moving objects. A bvh_node has to bound each moving sphere by its whole
+// swept path, so fast movers overlap everything they pass and every ray tests them. Here the
+// shutter interval [0,1] is cut into segments, and each node keeps a pair of boxes per segment:
+// its bounds at the segment's start and end. A ray linearly interpolates the pair for its own
+// time, which gives a box close to the objects' positions at that instant.
+//
+// The segment count is the least common multiple of the objects' motion_segments(), capped at
+// max_segments. An object whose motion knots don't fall on the segment ends is bounded by a
+// constant box over each segment instead, which is still correct, just looser.
+class motion_bvh : public hittable {
+  public:
+    motion_bvh(hittable_list list, int max_segments = 8) {
+        trace_scope trace("bvh build", "build");
+
+        objects = list.objects;
+        if (objects.empty())
+            return;
+
+        bbox = list.bounding_box();
+        segments = std::max(1, std::min(list.motion_segments(), max_segments));
+
+        // Per-object keys, and the centers at mid-shutter that the median splits sort on.
+        std::vector<aabb> object_keys(objects.size() * segments * 2);
+        std::vector<point3> centers;
+        for (size_t i = 0; i < objects.size(); i++) {
+            object_keys_for(*objects[i], &object_keys[i * segments * 2]);
+            auto mid = objects[i]->bounding_box_at(0.5);
+            centers.push_back(point3((mid.x.min + mid.x.max) / 2,
+                                     (mid.y.min + mid.y.max) / 2,
+                                     (mid.z.min + mid.z.max) / 2));
+        }
+
+        std::vector<int> order(objects.size());
+        std::iota(order.begin(), order.end(), 0);
+        build(order, 0, order.size(), centers, object_keys);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (objects.empty() || !bbox.hit(r, ray_t))
+            return false;
+
+        // The segment and the position within it are the same for every node on this ray.
+        auto x = std::fmin(std::fmax(r.time(), 0.0), 1.0) * segments;
+        auto s = std::min(int(x), segments - 1);
+        auto f = x - s;
+
+        // Median splits keep the depth within log2(n) + 1, so 64 entries are plenty.
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        bool hit_anything = false;
+
+        while (top > 0) {
+            const auto& n = nodes[stack[--top]];
+            RT_STAT_INC(nodes_visited);
+
+            const auto* key = &keys[(n.first_key + s) * 2];
+            if (!lerp(key[0], key[1], f).hit(r, ray_t))
+                continue;
+
+            if (n.object >= 0) {
+                if (objects[n.object]->hit(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+                continue;
+            }
+
+            // Visit the child nearer along the split axis first: push it last.
+            int near = r.sign(n.axis);
+            stack[top++] = near ? n.left : n.right;
+            stack[top++] = near ? n.right : n.left;
+        }
+
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    aabb bounding_box_at(double time) const override {
+        aabb box = aabb::empty;
+        for (const auto& object : objects)
+            box = aabb(box, object->bounding_box_at(time));
+        return box;
+    }
+
+    int motion_segments() const override { return segments; }
+
+    size_t node_count() const { return nodes.size(); }
+
+  private:
+    class node {
+      public:
+        int first_key;      // This node's keys start at keys[first_key * 2]
+        int left = -1;      // Child node indices, for an interior node
+        int right = -1;
+        int object = -1;    // Index into objects, for a leaf
+        int axis = 0;       // Split axis, for near-first traversal
+    };
+
+    std::vector<shared_ptr<hittable>> objects;
+    std::vector<node> nodes;
+    std::vector<aabb> keys;  // Per node, per segment: bounds at the segment's start and end
+    aabb bbox;
+    int segments = 1;
+
+    static aabb lerp(const aabb& a, const aabb& b, double f) {
+        // A box's min is the least of its contents' coordinates, so if the contents move in
+        // straight lines, interpolating the ends' mins never passes above them (likewise maxes).
+        auto axis = [f](const interval& p, const interval& q) {
+            return interval(p.min + f * (q.min - p.min), p.max + f * (q.max - p.max));
+        };
+        return aabb(axis(a.x, b.x), axis(a.y, b.y), axis(a.z, b.z));
+    }
+
+    void object_keys_for(const hittable& object, aabb* out) const {
+        int m = std::max(1, object.motion_segments());
+
+        for (int s = 0; s < segments; s++) {
+            double t0 = double(s) / segments;
+            double t1 = double(s + 1) / segments;
+            auto start = object.bounding_box_at(t0);
+            auto end = object.bounding_box_at(t1);
+
+            if (segments % m != 0) {
+                // Knots inside the segment break the straight line; hold one box over all of it.
+                // Between knots the object's bounds are interpolated, so the boxes at the
+                // segment ends and the knots within cover everything.
+                for (int k = int(std::floor(t0 * m)) + 1; k < t1 * m; k++)
+                    start = aabb(start, object.bounding_box_at(double(k) / m));
+                start = end = aabb(start, end);
+            }
+
+            out[s * 2] = start;
+            out[s * 2 + 1] = end;
+        }
+    }
+
+    int build(std::vector<int>& order, size_t start, size_t end,
+              const std::vector<point3>& centers, const std::vector<aabb>& object_keys) {
+        // Returns the node for objects order[start, end): a leaf for a single object, otherwise
+        // a median split along the longest axis of their mid-shutter centers.
+        int index = int(nodes.size());
+        nodes.emplace_back();
+        nodes[index].first_key = index * segments;
+        keys.resize(keys.size() + segments * 2);
+
+        if (end - start == 1) {
+            auto object = order[start];
+            nodes[index].object = object;
+            std::copy_n(&object_keys[object * segments * 2], segments * 2, &keys[index * segments * 2]);
+            return index;
+        }
+
+        aabb span = aabb::empty;
+        for (size_t i = start; i < end; i++)
+            span = aabb(span, aabb(centers[order[i]], centers[order[i]]));
+
+        int axis = span.longest_axis();
+        auto mid = start + (end - start) / 2;
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                         [&](int a, int b) { return centers[a][axis] < centers[b][axis]; });
+
+        auto left = build(order, start, mid, centers, object_keys);
+        auto right = build(order, mid, end, centers, object_keys);
+
+        nodes[index].left = left;
+        nodes[index].right = right;
+        nodes[index].axis = axis;
+        for (int k = 0; k < segments * 2; k++)
+            keys[index * segments * 2 + k] = aabb(keys[left * segments * 2 + k],
+                                                  keys[right * segments * 2 + k]);
+        return index;
+    }
+};
+
+#endif
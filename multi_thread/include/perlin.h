@@ -4,11 +4,34 @@
 #include "rtweekend.h"
 #include "color.h"
 
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+    #include <immintrin.h>
+    #define PERLIN_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Gradient noise after Perlin, with the gradients chosen from 256 random unit vectors by
+// hashing each lattice point through three permutations.
+//
+// Points are evaluated in blocks of `lanes`, each step done across the block: the hashes, the
+// gradients gathered for each of a cell's eight corners, and their weighted sum. On processors
+// with AVX2 that is an explicit kernel of four points per register; elsewhere, loops of fixed
+// length the compiler vectorizes where it can. turb() fills a block with a point's octaves and
+// the batch calls with many points, so both keep the lanes busy. Each lane does the same
+// arithmetic in the same order as evaluating its point alone, so the patterns are unchanged to
+// the bit.
 class perlin {
   public:
+    static constexpr int lanes = 8;
+
     perlin() {
         for (int i = 0; i < point_count; i++) {
-            randvec[i] = unit_vector(vec3::random(-1,1));
+            auto g = unit_vector(vec3::random(-1,1));
+            gradient_x[i] = g.x();
+            gradient_y[i] = g.y();
+            gradient_z[i] = g.z();
         }
 
         perlin_generate_perm(perm_x);
@@ -17,47 +40,72 @@ class perlin {
     }
 
     double noise(const point3& p) const {
-        auto u = p.x() - std::floor(p.x());
-        auto v = p.y() - std::floor(p.y());
-        auto w = p.z() - std::floor(p.z());
-        u = u*u*(3-2*u);
-        v = v*v*(3-2*v);
-        w = w*w*(3-2*w);
-
-        auto i = int(std::floor(p.x()));
-        auto j = int(std::floor(p.y()));
-        auto k = int(std::floor(p.z()));
-        vec3 c[2][2][2];
-
-        for (int di=0; di < 2; di++)
-            for (int dj=0; dj < 2; dj++)
-                for (int dk=0; dk < 2; dk++)
-                    c[di][dj][dk] = randvec[
-                        perm_x[(i+di) & 255] ^
-                        perm_y[(j+dj) & 255] ^
-                        perm_z[(k+dk) & 255]
-                    ];
-
-        return perlin_interp(c, u, v, w);
+        double value;
+        noise_block(&p, &value, 1);
+        return value;
     }
 
     double turb(const point3& p, int depth) const {
+        // The octaves go through the lanes together.
         auto accum = 0.0;
         auto temp_p = p;
         auto weight = 1.0;
 
-        for (int i = 0; i < depth; i++) {
-            accum += weight * noise(temp_p);
-            weight *= 0.5;
-            temp_p *= 2;
+        for (int first = 0; first < depth; first += lanes) {
+            int n = std::min(lanes, depth - first);
+            point3 octaves[lanes];
+            double values[lanes];
+            for (int l = 0; l < n; l++) {
+                octaves[l] = temp_p;
+                temp_p *= 2;
+            }
+
+            noise_block(octaves, values, n);
+            for (int l = 0; l < n; l++) {
+                accum += weight * values[l];
+                weight *= 0.5;
+            }
         }
 
         return std::fabs(accum);
     }
 
+    // noise() and turb() of count points at once, lanes points to a block.
+    void noise(const point3* points, double* values, size_t count) const {
+        for (size_t start = 0; start < count; start += lanes)
+            noise_block(points + start, values + start, int(std::min<size_t>(lanes, count - start)));
+    }
+
+    void turb(const point3* points, double* values, size_t count, int depth) const {
+        for (size_t start = 0; start < count; start += lanes) {
+            int n = int(std::min<size_t>(lanes, count - start));
+            point3 temp_p[lanes];
+            double accum[lanes], octave[lanes];
+            for (int l = 0; l < n; l++) {
+                temp_p[l] = points[start + l];
+                accum[l] = 0.0;
+            }
+
+            auto weight = 1.0;
+            for (int i = 0; i < depth; i++) {
+                noise_block(temp_p, octave, n);
+                for (int l = 0; l < n; l++) {
+                    accum[l] += weight * octave[l];
+                    temp_p[l] *= 2;
+                }
+                weight *= 0.5;
+            }
+
+            for (int l = 0; l < n; l++)
+                values[start + l] = std::fabs(accum[l]);
+        }
+    }
+
   private:
     static const int point_count = 256;
-    vec3 randvec[point_count];
+    double gradient_x[point_count];  // The random unit vectors, a component per array
+    double gradient_y[point_count];
+    double gradient_z[point_count];
     int perm_x[point_count];
     int perm_y[point_count];
     int perm_z[point_count];
@@ -78,24 +126,186 @@ class perlin {
         }
     }
 
-    static double perlin_interp(const vec3 c[2][2][2], double u, double v, double w) {
-        auto uu = u*u*(3-2*u);
-        auto vv = v*v*(3-2*v);
-        auto ww = w*w*(3-2*w);
-        auto accum = 0.0;
+    template <int width>
+    void noise_lanes(const point3* p, double* values, int n) const {
+        // Noise at p[0] to p[n-1], n <= width. Unused lanes repeat the last point, so every
+        // loop runs the full width.
+        double x[width], y[width], z[width];
+        for (int l = 0; l < width; l++) {
+            const auto& q = p[std::min(l, n - 1)];
+            x[l] = q.x();
+            y[l] = q.y();
+            z[l] = q.z();
+        }
+
+        // The cell, and the offsets into it; floor without the library call, which doesn't
+        // vectorize.
+        int i[width], j[width], k[width];
+        double u[width], v[width], w[width];
+        for (int l = 0; l < width; l++) {
+            i[l] = int(x[l]); i[l] -= i[l] > x[l];
+            j[l] = int(y[l]); j[l] -= j[l] > y[l];
+            k[l] = int(z[l]); k[l] -= k[l] > z[l];
+            u[l] = x[l] - i[l];
+            v[l] = y[l] - j[l];
+            w[l] = z[l] - k[l];
+        }
+
+        // The offsets are smoothed once, and the corner weights smoothed again from those; the
+        // pattern has always been made that way. Each axis has a weight and an offset from the
+        // corner per side of the cell.
+        double weight_u[2][width], weight_v[2][width], weight_w[2][width];
+        double offset_u[2][width], offset_v[2][width], offset_w[2][width];
+        for (int l = 0; l < width; l++) {
+            u[l] = u[l]*u[l]*(3-2*u[l]);
+            v[l] = v[l]*v[l]*(3-2*v[l]);
+            w[l] = w[l]*w[l]*(3-2*w[l]);
+            weight_u[1][l] = u[l]*u[l]*(3-2*u[l]);
+            weight_v[1][l] = v[l]*v[l]*(3-2*v[l]);
+            weight_w[1][l] = w[l]*w[l]*(3-2*w[l]);
+            weight_u[0][l] = 1 - weight_u[1][l];
+            weight_v[0][l] = 1 - weight_v[1][l];
+            weight_w[0][l] = 1 - weight_w[1][l];
+            offset_u[0][l] = u[l];
+            offset_v[0][l] = v[l];
+            offset_w[0][l] = w[l];
+            offset_u[1][l] = u[l] - 1;
+            offset_v[1][l] = v[l] - 1;
+            offset_w[1][l] = w[l] - 1;
+        }
+
+        // Each axis hashes two lattice coordinates, which the eight corners combine.
+        int hash_x[2][width], hash_y[2][width], hash_z[2][width];
+        for (int l = 0; l < width; l++) {
+            for (int d = 0; d < 2; d++) {
+                hash_x[d][l] = perm_x[(i[l]+d) & 255];
+                hash_y[d][l] = perm_y[(j[l]+d) & 255];
+                hash_z[d][l] = perm_z[(k[l]+d) & 255];
+            }
+        }
 
-        for (int i=0; i < 2; i++)
-            for (int j=0; j < 2; j++)
-                for (int k=0; k < 2; k++) {
-                    vec3 weight_v(u-i, v-j, w-k);
-                    accum += (i*uu + (1-i)*(1-uu))
-                            * (j*vv + (1-j)*(1-vv))
-                            * (k*ww + (1-k)*(1-ww))
-                            * dot(c[i][j][k], weight_v);
+        // The corners' terms, summed in the order the pattern was defined with.
+        double accum[width] = {};
+        for (int di = 0; di < 2; di++) {
+            for (int dj = 0; dj < 2; dj++) {
+                double weight_uv[width];
+                for (int l = 0; l < width; l++)
+                    weight_uv[l] = weight_u[di][l] * weight_v[dj][l];
+
+                for (int dk = 0; dk < 2; dk++) {
+                    for (int l = 0; l < width; l++) {
+                        auto h = hash_x[di][l] ^ hash_y[dj][l] ^ hash_z[dk][l];
+                        auto dot = gradient_x[h] * offset_u[di][l] + gradient_y[h] * offset_v[dj][l]
+                                 + gradient_z[h] * offset_w[dk][l];
+                        accum[l] += weight_uv[l] * weight_w[dk][l] * dot;
+                    }
                 }
+            }
+        }
+
+        for (int l = 0; l < n; l++)
+            values[l] = accum[l];
+    }
 
-        return accum;
+    void noise_block(const point3* p, double* values, int n) const {
+        if (n == 1)
+            noise_lanes<1>(p, values, n);
+#if defined(PERLIN_AVX2)
+        else if (has_avx2())
+            noise_avx2(p, values, n);
+#endif
+        else
+            noise_lanes<lanes>(p, values, n);
     }
+
+#if defined(PERLIN_AVX2)
+    static bool has_avx2() {
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+    }
+
+    // noise_lanes for processors with AVX2, whose gathers the compiler won't produce for it:
+    // four points to a register, the same arithmetic on each. Only AVX2 is enabled, not FMA,
+    // which would round differently.
+    PERLIN_AVX2 void noise_avx2(const point3* p, double* values, int n) const {
+        const auto one = _mm256_set1_pd(1);
+        const auto byte = _mm_set1_epi32(255);
+        // Gathers take every lane over a zeroed source, rather than the unmasked form's
+        // undefined one, which GCC warns may be used uninitialized.
+        const auto zero = _mm256_setzero_pd();
+        const auto all_lanes = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+
+        for (int first = 0; first < n; first += 4) {
+            const point3* q[4];
+            for (int l = 0; l < 4; l++)
+                q[l] = &p[std::min(first + l, n - 1)];
+
+            auto x = _mm256_setr_pd(q[0]->x(), q[1]->x(), q[2]->x(), q[3]->x());
+            auto y = _mm256_setr_pd(q[0]->y(), q[1]->y(), q[2]->y(), q[3]->y());
+            auto z = _mm256_setr_pd(q[0]->z(), q[1]->z(), q[2]->z(), q[3]->z());
+            auto fx = _mm256_floor_pd(x);
+            auto fy = _mm256_floor_pd(y);
+            auto fz = _mm256_floor_pd(z);
+            auto i = _mm256_cvttpd_epi32(fx);
+            auto j = _mm256_cvttpd_epi32(fy);
+            auto k = _mm256_cvttpd_epi32(fz);
+
+            __m256d offset_u[2], offset_v[2], offset_w[2];
+            offset_u[0] = smoothstep(_mm256_sub_pd(x, fx));
+            offset_v[0] = smoothstep(_mm256_sub_pd(y, fy));
+            offset_w[0] = smoothstep(_mm256_sub_pd(z, fz));
+            offset_u[1] = _mm256_sub_pd(offset_u[0], one);
+            offset_v[1] = _mm256_sub_pd(offset_v[0], one);
+            offset_w[1] = _mm256_sub_pd(offset_w[0], one);
+
+            __m256d weight_u[2], weight_v[2], weight_w[2];
+            weight_u[1] = smoothstep(offset_u[0]);
+            weight_v[1] = smoothstep(offset_v[0]);
+            weight_w[1] = smoothstep(offset_w[0]);
+            weight_u[0] = _mm256_sub_pd(one, weight_u[1]);
+            weight_v[0] = _mm256_sub_pd(one, weight_v[1]);
+            weight_w[0] = _mm256_sub_pd(one, weight_w[1]);
+
+            __m128i hash_x[2], hash_y[2], hash_z[2];
+            for (int d = 0; d < 2; d++) {
+                auto delta = _mm_set1_epi32(d);
+                hash_x[d] = _mm_i32gather_epi32(perm_x, _mm_and_si128(_mm_add_epi32(i, delta), byte), 4);
+                hash_y[d] = _mm_i32gather_epi32(perm_y, _mm_and_si128(_mm_add_epi32(j, delta), byte), 4);
+                hash_z[d] = _mm_i32gather_epi32(perm_z, _mm_and_si128(_mm_add_epi32(k, delta), byte), 4);
+            }
+
+            auto accum = _mm256_setzero_pd();
+            for (int di = 0; di < 2; di++) {
+                for (int dj = 0; dj < 2; dj++) {
+                    auto weight_uv = _mm256_mul_pd(weight_u[di], weight_v[dj]);
+                    auto hash_xy = _mm_xor_si128(hash_x[di], hash_y[dj]);
+                    for (int dk = 0; dk < 2; dk++) {
+                        auto h = _mm_xor_si128(hash_xy, hash_z[dk]);
+                        auto gx = _mm256_mask_i32gather_pd(zero, gradient_x, h, all_lanes, 8);
+                        auto gy = _mm256_mask_i32gather_pd(zero, gradient_y, h, all_lanes, 8);
+                        auto gz = _mm256_mask_i32gather_pd(zero, gradient_z, h, all_lanes, 8);
+                        auto dot = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(gx, offset_u[di]),
+                                                               _mm256_mul_pd(gy, offset_v[dj])),
+                                                 _mm256_mul_pd(gz, offset_w[dk]));
+                        auto weight = _mm256_mul_pd(weight_uv, weight_w[dk]);
+                        accum = _mm256_add_pd(accum, _mm256_mul_pd(weight, dot));
+                    }
+                }
+            }
+
+            double result[4];
+            _mm256_storeu_pd(result, accum);
+            for (int l = 0; l < 4 && first + l < n; l++)
+                values[first + l] = result[l];
+        }
+    }
+
+    PERLIN_AVX2 static __m256d smoothstep(__m256d t) {
+        // t*t*(3-2*t), in that order.
+        return _mm256_mul_pd(_mm256_mul_pd(t, t),
+                             _mm256_sub_pd(_mm256_set1_pd(3), _mm256_mul_pd(_mm256_set1_pd(2), t)));
+    }
+#endif
 };
 
 #endif
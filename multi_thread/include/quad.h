@@ -3,6 +3,7 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "material.h"
 
 class quad : public hittable {
   public:
@@ -28,7 +29,13 @@ class quad : public hittable {
 
     aabb bounding_box() const override { return bbox; }
 
+    aabb clipped_bounding_box(const aabb& clip) const override {
+        return clipped_polygon_box({Q, Q + u, Q + u + v, Q + v}, clip);
+    }
+
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        RT_STAT_INC(primitive_tests);
+
         auto denom = dot(normal, r.direction());
 
         // No hit if the ray is parallel to the plane.
@@ -49,31 +56,52 @@ class quad : public hittable {
         if (!is_interior(alpha, beta, rec))
             return false;
 
-        // Ray hits the 2D shape; set the rest of the hit record and return true.
+        // Ray hits the 2D shape; the plane coordinates are already in rec.u and rec.v.
         rec.t = t;
-        rec.p = intersection;
-        rec.mat = mat;
-        rec.set_face_normal(r, normal);
+        rec.prim = this;
 
         return true;
     }
 
+    void finalize(const ray& r, hit_record& rec) const override {
+        rec.p = r.at(rec.t);
+        rec.mat = mat;
+        rec.set_face_normal(r, normal);
+        rec.dpdu = u;
+        rec.dpdv = v;
+    }
+
     double pdf_value(const point3& origin, const vec3& direction) const override {
         hit_record rec;
         if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
             return 0;
 
         auto distance_squared = rec.t * rec.t * direction.length_squared();
-        auto cosine = std::fabs(dot(direction, rec.normal) / direction.length());
+        auto cosine = std::fabs(dot(direction, normal) / direction.length());
 
         return distance_squared / (cosine * area);
     }
 
+    double light_power() const override {
+        return mat ? area * luminance(mat->average_emission()) : 0;
+    }
+
+    emission_cone light_cone() const override {
+        // Emits from the front face only, over its whole hemisphere.
+        emission_cone cone;
+        cone.axis = normal;
+        cone.cos_theta_o = 1;
+        return cone;
+    }
+
     vec3 random(const point3& origin) const override {
         auto p = Q + (random_double() * u) + (random_double() * v);
         return p - origin;
     }    
 
+    // The point at plane coordinates (a,b), which are its texture coordinates.
+    point3 surface_point(double a, double b) const { return Q + a*u + b*v; }
+
     virtual bool is_interior(double a, double b, hit_record& rec) const {
             interval unit_interval = interval(0, 1);
             // Given the hit point in plane coordinates, return false if it is outside the
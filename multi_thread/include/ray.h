@@ -10,13 +10,24 @@ class ray {
     ray(const point3& origin, const vec3& direction, double time) : 
     orig(origin), 
     dir(direction),
-    tm(time){}
+    tm(time)
+    {
+        // Box tests divide by the direction on every node; do it once per ray instead. A zero
+        // component gives an infinite reciprocal, whose sign still says which way the ray runs.
+        inv_dir = vec3(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+        for (int axis = 0; axis < 3; axis++)
+            dir_is_neg[axis] = inv_dir[axis] < 0;
+    }
 
     ray(const point3& origin, const vec3& direction)
         : ray(origin, direction, 0) {}
 
     const point3& origin() const  { return orig; }
     const vec3& direction() const { return dir; }
+    const vec3& inv_direction() const { return inv_dir; }
+
+    // 1 if the ray runs toward -axis, so a box's near slab is its max along that axis.
+    int sign(int axis) const { return dir_is_neg[axis]; }
 
     double time() const { return tm; }
 
@@ -29,6 +40,30 @@ class ray {
     point3 orig;
     vec3 dir;
     double tm;
+    vec3 inv_dir;
+    int dir_is_neg[3];
+};
+
+
+// The rays through the neighbouring pixels (one step in image x, one in y) that follow a camera
+// ray's path through specular bounces, for estimating how much of a surface one pixel sample
+// covers. Directions are unit length.
+class ray_differential {
+  public:
+    bool valid = false;
+    point3 rx_origin, ry_origin;
+    vec3 rx_direction, ry_direction;
+};
+
+
+// Where a ray differential lands on a textured surface: how far the texture coordinates move
+// from one pixel to the next in image x and in y. All zero asks for a point lookup.
+class texture_footprint {
+  public:
+    double dudx = 0, dvdx = 0;
+    double dudy = 0, dvdy = 0;
+
+    bool empty() const { return dudx == 0 && dvdx == 0 && dudy == 0 && dvdy == 0; }
 };
 
 #endif
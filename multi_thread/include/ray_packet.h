@@ -0,0 +1,53 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "interval.h"
+#include "ray.h"
+
+
+// A group of rays traced through the scene together. Each field is stored once per lane, so
+// box tests over the whole packet become plain loops over arrays that the compiler can
+// vectorize. Lanes are selected with a bit mask: bit i set means lane i takes part.
+class ray_packet {
+  public:
+    static constexpr int width = 8;
+    static constexpr unsigned all_lanes = (1u << width) - 1;
+
+    double ox[width], oy[width], oz[width];            // Origins
+    double dx[width], dy[width], dz[width];            // Directions
+    double inv_dx[width], inv_dy[width], inv_dz[width];
+    double time[width];
+    double t_min[width], t_max[width];                 // t_max shrinks to the closest hit so far
+
+    ray_packet() {
+        // Unused lanes get a harmless ray with an empty interval.
+        for (int i = 0; i < width; i++)
+            set(i, ray(point3(0,0,0), vec3(1,1,1), 0), interval::empty);
+    }
+
+    void set(int lane, const ray& r, const interval& ray_t) {
+        const auto& o = r.origin();
+        const auto& d = r.direction();
+        const auto& inv_d = r.inv_direction();
+
+        ox[lane] = o.x();  oy[lane] = o.y();  oz[lane] = o.z();
+        dx[lane] = d.x();  dy[lane] = d.y();  dz[lane] = d.z();
+        inv_dx[lane] = inv_d.x();
+        inv_dy[lane] = inv_d.y();
+        inv_dz[lane] = inv_d.z();
+        time[lane] = r.time();
+        t_min[lane] = ray_t.min;
+        t_max[lane] = ray_t.max;
+    }
+
+    ray get_ray(int lane) const {
+        return ray(point3(ox[lane], oy[lane], oz[lane]), vec3(dx[lane], dy[lane], dz[lane]),
+                   time[lane]);
+    }
+
+    interval get_interval(int lane) const { return interval(t_min[lane], t_max[lane]); }
+
+    static int count(unsigned mask) { return __builtin_popcount(mask); }
+};
+
+#endif
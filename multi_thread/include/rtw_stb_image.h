@@ -9,21 +9,32 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_FAILURE_USERMSG
 #include "external/stb_image.h"
+#include "trace.h"
 
+#include <array>
+#include <cmath>
 #include <cstdlib>
 #include <iostream>
+#include <string>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
 
 class rtw_image {
   public:
     rtw_image() {}
 
-    rtw_image(const char* image_filename) {
+    rtw_image(const char* image_filename, bool with_bytes = true) : with_bytes(with_bytes) {
         // Loads image data from the specified file. If the RTW_IMAGES environment variable is
         // defined, looks only in that directory for the image file. If the image was not found,
         // searches for the specified image file first from the current directory, then in the
         // images/ subdirectory, then the _parent's_ images/ subdirectory, and then _that_
         // parent, on so on, for six levels up. If the image was not loaded successfully,
-        // width() and height() will return 0.
+        // width() and height() will return 0. Without with_bytes only the float data is kept,
+        // for users that only read float_pixel_data.
+
+        trace_scope trace("texture decode", "load");
 
         auto filename = std::string(image_filename);
         auto imagedir = getenv("RTW_IMAGES");
@@ -55,14 +66,22 @@ class rtw_image {
         // below, for the full height of the image.
 
         auto n = bytes_per_pixel; // Dummy out parameter: original components per pixel
-        fdata = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
+        if (stbi_is_hdr(filename.c_str()))
+            fdata = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
+        else
+            fdata = load_linearized(filename);
         if (fdata == nullptr) return false;
 
         bytes_per_scanline = image_width * bytes_per_pixel;
-        convert_to_bytes();
+        if (with_bytes)
+            convert_to_bytes();
+        loaded_path = filename;
         return true;
     }
 
+    // The file the data was loaded from, after the search above; empty if none was.
+    const std::string& path() const { return loaded_path; }
+
     int width()  const { return (fdata == nullptr) ? 0 : image_width; }
     int height() const { return (fdata == nullptr) ? 0 : image_height; }
 
@@ -78,6 +97,42 @@ class rtw_image {
         return bdata + y*bytes_per_scanline + x*bytes_per_pixel;
     }
 
+    const float* float_pixel_data(int x, int y) const {
+        // Return the address of the three linear RGB floats of the pixel at x,y, unclamped to
+        // [0,1] as an HDR image needs. If there is no image data, returns magenta.
+        static const float magenta[] = { 1, 0, 1 };
+        if (fdata == nullptr) return magenta;
+
+        x = clamp(x, 0, image_width);
+        y = clamp(y, 0, image_height);
+
+        return fdata + y*bytes_per_scanline + x*bytes_per_pixel;
+    }
+
+    static void float_to_bytes(const float* values, unsigned char* bytes, size_t count) {
+        // float_to_byte over an array. With SSE2 (any x86-64) sixteen values go at a time,
+        // scaled, clamped to [0, 255] and truncated: the same function, as scaling by 256 is
+        // exact.
+        size_t i = 0;
+#if defined(__SSE2__)
+        const auto zero = _mm_setzero_ps();
+        const auto top = _mm_set1_ps(255.0f);
+        const auto scale = _mm_set1_ps(256.0f);
+        for (; i + 16 <= count; i += 16) {
+            __m128i quads[4];
+            for (int k = 0; k < 4; k++) {
+                auto v = _mm_mul_ps(_mm_loadu_ps(values + i + 4*k), scale);
+                quads[k] = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(v, zero), top));
+            }
+            auto low = _mm_packs_epi32(quads[0], quads[1]);
+            auto high = _mm_packs_epi32(quads[2], quads[3]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes + i), _mm_packus_epi16(low, high));
+        }
+#endif
+        for (; i < count; i++)
+            bytes[i] = float_to_byte(values[i]);
+    }
+
   private:
     const int      bytes_per_pixel = 3;
     float         *fdata = nullptr;         // Linear floating point pixel data
@@ -85,6 +140,8 @@ class rtw_image {
     int            image_width = 0;         // Loaded image width
     int            image_height = 0;        // Loaded image height
     int            bytes_per_scanline = 0;
+    bool           with_bytes = true;       // Whether load() fills bdata
+    std::string    loaded_path;
 
     static int clamp(int x, int low, int high) {
         // Return the value clamped to the range [low, high).
@@ -101,20 +158,39 @@ class rtw_image {
         return static_cast<unsigned char>(256.0 * value);
     }
 
+    float* load_linearized(const std::string& filename) {
+        // What stbi_loadf returns for an 8-bit image, the same floats, but faster: stbi_loadf
+        // linearizes each component with a pow(), which takes several times as long as the
+        // decode itself. There are only 256 byte values, so their pow()s go in a table, worked
+        // out by the same expression.
+        static const auto linear = [] {
+            std::array<float, 256> table;
+            for (int i = 0; i < 256; i++)
+                table[i] = (float) (pow(i/255.0f, stbi__l2h_gamma) * stbi__l2h_scale);
+            return table;
+        }();
+
+        auto n = bytes_per_pixel;
+        auto data = stbi_load(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
+        if (data == nullptr) return nullptr;
+
+        auto count = size_t(image_width) * image_height * bytes_per_pixel;
+        auto values = static_cast<float*>(STBI_MALLOC(count * sizeof(float)));
+        if (values != nullptr)
+            for (size_t i = 0; i < count; i++)
+                values[i] = linear[data[i]];
+
+        stbi_image_free(data);
+        return values;
+    }
+
     void convert_to_bytes() {
         // Convert the linear floating point pixel data to bytes, storing the resulting byte
         // data in the `bdata` member.
 
-        int total_bytes = image_width * image_height * bytes_per_pixel;
+        auto total_bytes = size_t(image_width) * image_height * bytes_per_pixel;
         bdata = new unsigned char[total_bytes];
-
-        // Iterate through all pixel components, converting from [0.0, 1.0] float values to
-        // unsigned [0, 255] byte values.
-
-        auto *bptr = bdata;
-        auto *fptr = fdata;
-        for (auto i=0; i < total_bytes; i++, fptr++, bptr++)
-            *bptr = float_to_byte(*fptr);
+        float_to_bytes(fdata, bdata, total_bytes);
     }
 };
 
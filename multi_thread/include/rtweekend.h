@@ -28,6 +28,11 @@ inline double degrees_to_radians(double degrees) {
 thread_local std::mt19937 gen(std::random_device{}());
 thread_local std::uniform_real_distribution<double> dis(0.0, 1.0);
 
+inline void seed_random(unsigned int seed) {
+    // Restarts this thread's random sequence from the given seed.
+    gen.seed(seed);
+}
+
 inline double random_double() {
     return dis(gen);
 }
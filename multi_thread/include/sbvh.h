@@ -0,0 +1,296 @@
+#ifndef SBVH_H
+#define SBVH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <vector>
+
+
+class sbvh_options {
+  public:
+    // Extra object references the spatial splits may create, as a fraction of the object
+    // count. 0 turns spatial splits off and leaves a plain SAH object-split BVH.
+    double duplicate_budget = 0.5;
+
+    int spatial_bins = 32;
+
+    // Spatial splits are only tried where the best object split's children overlap by more than
+    // this fraction of the root's surface area.
+    double overlap_threshold = 1e-5;
+};
+
+
+// Builds a BVH out of bvh_nodes with the spatial split strategy of Stich, Friedrich and
+// Dietrich's SBVH. At each node it finds the best surface area heuristic split that partitions
+// the objects, and, where that split leaves its two children overlapping, also the best split
+// of space: a plane that cuts the objects straddling it in two, each half clipped to its side.
+// Straddling objects are then referenced from both children, with a tighter box on each side.
+// That keeps a large ground quad or a long box wall from sitting near the root with a box that
+// overlaps everything under it, at the price of a slower build and some repeated hit tests.
+class sbvh_builder {
+  public:
+    sbvh_builder(const hittable_list& list, const sbvh_options& options = sbvh_options())
+      : objects(list.objects), options(options)
+    {
+        root_area = half_area(list.bounding_box());
+        duplicate_limit = size_t(options.duplicate_budget * objects.size());
+    }
+
+    shared_ptr<hittable> build() {
+        trace_scope trace("bvh build", "build");
+
+        if (objects.empty())
+            return make_shared<hittable_list>();
+
+        std::vector<reference> refs;
+        for (size_t i = 0; i < objects.size(); i++)
+            refs.push_back({int(i), objects[i]->bounding_box()});
+
+        aabb box;
+        return build_node(refs, 0, box);
+    }
+
+    // References made beyond one per object.
+    size_t duplicates() const { return duplicated; }
+
+  private:
+    class reference {
+      public:
+        int index;  // Into objects
+        aabb box;   // The object's bounds, clipped to the part this reference covers
+    };
+
+    class split {
+      public:
+        double cost = infinity;
+        int axis = 0;
+        bool spatial = false;
+        size_t position = 0;   // Object split: number of sorted references on the left
+        double plane = 0;      // Spatial split: position along axis
+        size_t left_count = 0;
+        size_t right_count = 0;
+    };
+
+    std::vector<shared_ptr<hittable>> objects;
+    sbvh_options options;
+    double root_area;
+    size_t duplicate_limit;
+    size_t duplicated = 0;
+
+    static double half_area(const aabb& box) {
+        if (is_empty(box))
+            return 0;
+        auto dx = box.x.size(), dy = box.y.size(), dz = box.z.size();
+        return dx*dy + dy*dz + dz*dx;
+    }
+
+    static bool is_empty(const aabb& box) {
+        return box.x.size() < 0 || box.y.size() < 0 || box.z.size() < 0;
+    }
+
+    static double centroid(const reference& r, int axis) {
+        const auto& ax = r.box.axis_interval(axis);
+        return (ax.min + ax.max) / 2;
+    }
+
+    static aabb bounds(const std::vector<reference>& refs) {
+        aabb box = aabb::empty;
+        for (const auto& r : refs)
+            box = aabb(box, r.box);
+        return box;
+    }
+
+    static aabb slab(const aabb& box, int axis, double min, double max) {
+        // `box` with its extent along `axis` replaced by [min, max].
+        interval axes[3] = { box.x, box.y, box.z };
+        axes[axis] = interval(min, max);
+        return aabb(axes[0], axes[1], axes[2]);
+    }
+
+    aabb clip(const reference& r, int axis, double min, double max) const {
+        return objects[r.index]->clipped_bounding_box(intersect(r.box, slab(r.box, axis, min, max)));
+    }
+
+    split best_object_split(std::vector<reference>& refs, aabb& overlap) const {
+        // Sweeps the references sorted by centroid along each axis, scoring every prefix and
+        // suffix by surface area times count.
+        split best;
+        auto n = refs.size();
+        std::vector<aabb> right_boxes(n);
+
+        for (int axis = 0; axis < 3; axis++) {
+            std::sort(refs.begin(), refs.end(), [axis](const reference& a, const reference& b) {
+                return centroid(a, axis) < centroid(b, axis);
+            });
+
+            aabb right = aabb::empty;
+            for (size_t i = n; i-- > 0;) {
+                right = aabb(right, refs[i].box);
+                right_boxes[i] = right;
+            }
+
+            aabb left = aabb::empty;
+            for (size_t i = 1; i < n; i++) {
+                left = aabb(left, refs[i-1].box);
+                auto cost = half_area(left) * i + half_area(right_boxes[i]) * (n - i);
+                if (cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.position = i;
+                    best.left_count = i;
+                    best.right_count = n - i;
+                    overlap = intersect(left, right_boxes[i]);
+                }
+            }
+        }
+
+        return best;
+    }
+
+    split best_spatial_split(const std::vector<reference>& refs, const aabb& node_box) const {
+        // Bins space along each axis. Each reference is clipped into every bin it spans, and
+        // counted as entering its first bin and leaving its last, so a plane between bins k-1
+        // and k has the entries up to k-1 on its left and the exits from k on its right.
+        split best;
+        best.spatial = true;
+        int bins = options.spatial_bins;
+
+        for (int axis = 0; axis < 3; axis++) {
+            const auto& extent = node_box.axis_interval(axis);
+            auto width = extent.size() / bins;
+            if (!(width > 0))
+                continue;
+
+            std::vector<aabb> bin_boxes(bins, aabb::empty);
+            std::vector<size_t> entries(bins, 0), exits(bins, 0);
+
+            auto bin_of = [&](double x) {
+                return std::clamp(int((x - extent.min) / width), 0, bins - 1);
+            };
+
+            for (const auto& r : refs) {
+                const auto& ax = r.box.axis_interval(axis);
+                int first = bin_of(ax.min);
+                int last = bin_of(ax.max);
+                entries[first]++;
+                exits[last]++;
+
+                for (int b = first; b <= last; b++) {
+                    auto piece = first == last
+                        ? r.box
+                        : clip(r, axis, extent.min + b * width, extent.min + (b + 1) * width);
+                    bin_boxes[b] = aabb(bin_boxes[b], piece);
+                }
+            }
+
+            std::vector<aabb> right_boxes(bins);
+            aabb right = aabb::empty;
+            for (int b = bins; b-- > 0;) {
+                right = aabb(right, bin_boxes[b]);
+                right_boxes[b] = right;
+            }
+
+            aabb left = aabb::empty;
+            size_t left_count = 0;
+            size_t right_count = refs.size();
+            for (int k = 1; k < bins; k++) {
+                left = aabb(left, bin_boxes[k-1]);
+                left_count += entries[k-1];
+                right_count -= exits[k-1];
+
+                auto cost = half_area(left) * left_count + half_area(right_boxes[k]) * right_count;
+                if (cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.plane = extent.min + k * width;
+                    best.left_count = left_count;
+                    best.right_count = right_count;
+                }
+            }
+        }
+
+        return best;
+    }
+
+    bool split_spatially(const std::vector<reference>& refs, const split& s,
+                         std::vector<reference>& left, std::vector<reference>& right) const {
+        for (const auto& r : refs) {
+            const auto& ax = r.box.axis_interval(s.axis);
+            if (ax.max <= s.plane) {
+                left.push_back(r);
+            } else if (ax.min >= s.plane) {
+                right.push_back(r);
+            } else {
+                // The object's surface may miss one side of the plane within its box.
+                auto low = clip(r, s.axis, ax.min, s.plane);
+                auto high = clip(r, s.axis, s.plane, ax.max);
+                if (!is_empty(low)) left.push_back({r.index, low});
+                if (!is_empty(high)) right.push_back({r.index, high});
+            }
+        }
+
+        // Only accept a plane that takes something away from both sides, so the tree shrinks.
+        return left.size() < refs.size() && right.size() < refs.size()
+            && !left.empty() && !right.empty();
+    }
+
+    shared_ptr<hittable> build_node(std::vector<reference>& refs, int depth, aabb& box) {
+        // Returns the subtree over `refs` and sets `box` to its (clipped) bounds.
+        box = bounds(refs);
+
+        if (refs.size() == 1)
+            return objects[refs[0].index];
+
+        if (refs.size() == 2) {
+            int axis = box.longest_axis();
+            if (refs[1].box.axis_interval(axis).min < refs[0].box.axis_interval(axis).min)
+                std::swap(refs[0], refs[1]);
+            return make_shared<bvh_node>(objects[refs[0].index], objects[refs[1].index], box, axis);
+        }
+
+        aabb overlap;
+        auto best = best_object_split(refs, overlap);
+
+        std::vector<reference> left, right;
+        bool spatial = false;
+
+        if (depth < 48 && duplicated < duplicate_limit && half_area(overlap) > options.overlap_threshold * root_area) {
+            auto s = best_spatial_split(refs, box);
+            auto extra = s.left_count + s.right_count - refs.size();
+            if (s.cost < best.cost && duplicated + extra <= duplicate_limit
+                && split_spatially(refs, s, left, right)) {
+                spatial = true;
+                best = s;
+                duplicated += left.size() + right.size() - refs.size();
+            } else {
+                left.clear();
+                right.clear();
+            }
+        }
+
+        if (!spatial) {
+            std::sort(refs.begin(), refs.end(), [&](const reference& a, const reference& b) {
+                return centroid(a, best.axis) < centroid(b, best.axis);
+            });
+            left.assign(refs.begin(), refs.begin() + best.position);
+            right.assign(refs.begin() + best.position, refs.end());
+        }
+
+        // The references are copied into the children; free them before recursing.
+        std::vector<reference>().swap(refs);
+
+        aabb left_box, right_box;
+        auto left_child = build_node(left, depth + 1, left_box);
+        auto right_child = build_node(right, depth + 1, right_box);
+        box = aabb(left_box, right_box);
+
+        return make_shared<bvh_node>(left_child, right_child, box, best.axis);
+    }
+};
+
+#endif
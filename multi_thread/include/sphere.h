@@ -4,6 +4,7 @@
 #include "rtweekend.h"
 #include "hittable.h"
 #include "interval.h"
+#include "material.h"
 #include "onb.h"
 
 class sphere : public hittable {
@@ -30,6 +31,8 @@ class sphere : public hittable {
 
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        RT_STAT_INC(primitive_tests);
+
         point3 current_center = center.at(r.time());
         vec3 oc = current_center - r.origin();
         auto a = r.direction().length_squared();
@@ -51,17 +54,34 @@ class sphere : public hittable {
         }
 
         rec.t = root;
+        rec.prim = this;
+
+        return true;
+    }
+
+    void finalize(const ray& r, hit_record& rec) const override {
         rec.p = r.at(rec.t);
-        vec3 outward_normal = (rec.p - current_center) / radius;
+        vec3 outward_normal = (rec.p - center.at(r.time())) / radius;
         rec.set_face_normal(r, outward_normal);
         get_sphere_uv(outward_normal, rec.u, rec.v);
         rec.mat = mat;
 
-        return true;
+        // Derivatives of get_sphere_uv's inverse; both vanish at the poles.
+        const auto& n = outward_normal;
+        auto sin_theta = std::sqrt(n.x()*n.x() + n.z()*n.z());
+        rec.dpdu = 2*pi*radius * vec3(n.z(), 0, -n.x());
+        rec.dpdv = sin_theta > 0 ? pi*radius * vec3(-n.y()*n.x() / sin_theta, sin_theta,
+                                                    -n.y()*n.z() / sin_theta)
+                                 : vec3(0,0,0);
     }
 
     aabb bounding_box() const override { return bbox; }
 
+    aabb bounding_box_at(double time) const override {
+        auto rvec = vec3(radius, radius, radius);
+        return aabb(center.at(time) - rvec, center.at(time) + rvec);
+    }
+
 
     double pdf_value(const point3& origin, const vec3& direction) const override {
         // This method only works for stationary spheres.
@@ -77,6 +97,10 @@ class sphere : public hittable {
         return  1 / solid_angle;
     }
 
+    double light_power() const override {
+        return mat ? 4*pi*radius*radius * luminance(mat->average_emission()) : 0;
+    }
+
     vec3 random(const point3& origin) const override {
         vec3 direction = center.at(0) - origin;
         auto distance_squared = direction.length_squared();
@@ -84,6 +108,16 @@ class sphere : public hittable {
         return uvw.transform(random_to_sphere(radius, distance_squared));
     }
 
+    // The surface point with texture coordinates (u,v), inverting get_sphere_uv; where the
+    // sphere starts if it moves.
+    point3 surface_point(double u, double v) const {
+        auto theta = v * pi;
+        auto phi = u * 2*pi - pi;
+        auto sin_theta = std::sin(theta);
+        return center.at(0)
+             + radius * vec3(sin_theta * std::cos(phi), -std::cos(theta), -sin_theta * std::sin(phi));
+    }
+
 
 
   private:
@@ -0,0 +1,132 @@
+#ifndef STATS_H
+#define STATS_H
+
+// Traversal statistics. Building with -DRT_STATS turns on per-thread counters in the BVH and
+// primitive intersection routines, and makes camera::render write per-pixel heatmaps of the
+// counts next to its output image. Without the flag every RT_STAT_* macro compiles to nothing.
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+
+class render_counters {
+  public:
+    long long nodes_visited = 0;    // bvh_node::hit calls
+    long long primitive_tests = 0;  // sphere, quad and triangle hit calls
+
+    static render_counters& local() {
+        // Each thread counts into its own copy; camera::render sums them per scanline.
+        thread_local render_counters counters;
+        return counters;
+    }
+};
+
+#ifdef RT_STATS
+    #define RT_STAT_INC(counter) (render_counters::local().counter++)
+#else
+    #define RT_STAT_INC(counter) ((void)0)
+#endif
+
+
+class heatmap {
+  public:
+    heatmap(int width, int height) : width(width), height(height), values(width * height, 0.0) {}
+
+    void set(int i, int j, double value) { values[j * width + i] = value; }
+
+    double total() const {
+        double sum = 0;
+        for (auto v : values) sum += v;
+        return sum;
+    }
+
+    double max() const { return *std::max_element(values.begin(), values.end()); }
+
+    void write(const std::string& filename) const {
+        // Scales to the 99th percentile so a few extreme pixels don't flatten the rest of the
+        // map, then writes a false-color PPM running black, blue, red, yellow, white.
+        auto sorted = values;
+        auto nth = sorted.begin() + (sorted.size() - 1) * 99 / 100;
+        std::nth_element(sorted.begin(), nth, sorted.end());
+        auto scale = *nth > 0 ? 1.0 / *nth : 0.0;
+
+        std::ofstream file(filename);
+        file << "P3\n" << width << ' ' << height << "\n255\n";
+        for (auto v : values) {
+            auto c = ramp(std::fmin(v * scale, 1.0));
+            file << int(255.999 * c[0]) << ' ' << int(255.999 * c[1]) << ' '
+                 << int(255.999 * c[2]) << '\n';
+        }
+    }
+
+  private:
+    int width, height;
+    std::vector<double> values;
+
+    static std::vector<double> ramp(double x) {
+        static const double stops[5][3] = {
+            {0, 0, 0}, {0.1, 0.1, 0.8}, {0.9, 0.1, 0.1}, {1, 0.9, 0.1}, {1, 1, 1}
+        };
+        auto f = x * 4;
+        int k = std::min(int(f), 3);
+        auto t = f - k;
+
+        return { (1-t)*stops[k][0] + t*stops[k+1][0],
+                 (1-t)*stops[k][1] + t*stops[k+1][1],
+                 (1-t)*stops[k][2] + t*stops[k+1][2] };
+    }
+};
+
+
+// Per-pixel cost maps gathered by camera::render when RT_STATS is defined.
+class stats_images {
+  public:
+    heatmap nodes, primitives, path_length, time;
+
+    stats_images(int width, int height)
+      : nodes(width, height), primitives(width, height), path_length(width, height),
+        time(width, height) {}
+
+    void write(const std::string& image_file) const {
+        // image.ppm becomes image_nodes.ppm, image_prims.ppm, image_depth.ppm and image_time.ppm.
+        auto stem = image_file.empty() ? std::string("stats") : image_file;
+        auto dot = stem.rfind('.');
+        if (dot != std::string::npos) stem = stem.substr(0, dot);
+
+        nodes.write(stem + "_nodes.ppm");
+        primitives.write(stem + "_prims.ppm");
+        path_length.write(stem + "_depth.ppm");
+        time.write(stem + "_time.ppm");
+    }
+};
+
+
+// One pixel's cost, for renderers that interleave pixels' work: shares of the counts and time
+// between points of the render are added up, then set on the heatmaps at once.
+class pixel_cost {
+  public:
+    double nodes = 0, primitives = 0, rays = 0, microseconds = 0;
+
+    void add_since(const render_counters& before, std::chrono::steady_clock::time_point start,
+                   double share) {
+        const auto& now = render_counters::local();
+        nodes += share * (now.nodes_visited - before.nodes_visited);
+        primitives += share * (now.primitive_tests - before.primitive_tests);
+        microseconds += share * std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+
+    void record(stats_images& heat, int i, int j, int samples) const {
+        heat.nodes.set(i, j, nodes);
+        heat.primitives.set(i, j, primitives);
+        heat.path_length.set(i, j, rays / samples);
+        heat.time.set(i, j, microseconds);
+    }
+};
+
+#endif
@@ -2,14 +2,24 @@
 #define TEXTURE_H
 
 #include "color.h"
+#include "mipmap.h"
+#include "ray.h"
 #include "perlin.h"
 #include "rtw_stb_image.h"
+#include "texture_cache.h"
 
 class texture {
   public:
     virtual ~texture() = default;
 
     virtual color value(double u, double v, const point3& p) const = 0;
+
+    // The value averaged over a footprint about (u,v); an empty one asks for the point value.
+    // Textures without image detail to alias keep the point value.
+    virtual color filtered_value(double u, double v, const point3& p,
+                                 const texture_footprint& footprint) const {
+        return value(u, v, p);
+    }
 };
 
 class solid_color : public texture {
@@ -44,6 +54,18 @@ class checker_texture : public texture {
         return isEven ? even->value(u, v, p) : odd->value(u, v, p);
     }
 
+    color filtered_value(double u, double v, const point3& p,
+                         const texture_footprint& footprint) const override {
+        auto xInteger = int(std::floor(inv_scale * p.x()));
+        auto yInteger = int(std::floor(inv_scale * p.y()));
+        auto zInteger = int(std::floor(inv_scale * p.z()));
+
+        bool isEven = (xInteger + yInteger + zInteger) % 2 == 0;
+
+        return isEven ? even->filtered_value(u, v, p, footprint)
+                      : odd->filtered_value(u, v, p, footprint);
+    }
+
   private:
     double inv_scale;
     shared_ptr<texture> even;
@@ -52,26 +74,47 @@ class checker_texture : public texture {
 
 class image_texture : public texture {
   public:
-    image_texture(const char* filename) : image(filename) {}
+    // Textures of the same file share one decoded pyramid in the texture cache. Decoding starts
+    // in the background now, or on the first lookup under a memory budget.
+    image_texture(const char* filename, texel_layout layout = texel_layout::tiled)
+      : image(&texture_cache::global().find(filename, layout))
+    {
+        texture_cache::global().prefetch(*image);
+    }
 
     color value(double u, double v, const point3& p) const override {
+        texture_cache::pin pyramid(*image);
+
         // If we have no texture data, then return solid cyan as a debugging aid.
-        if (image.height() <= 0) return color(0,1,1);
+        if (pyramid->empty()) return color(0,1,1);
 
         // Clamp input texture coordinates to [0,1] x [1,0]
         u = interval(0,1).clamp(u);
         v = 1.0 - interval(0,1).clamp(v);  // Flip V to image coordinates
 
-        auto i = int(u * image.width());
-        auto j = int(v * image.height());
-        auto pixel = image.pixel_data(i,j);
+        return pyramid->nearest(u, v);
+    }
+
+    color filtered_value(double u, double v, const point3& p,
+                         const texture_footprint& footprint) const override {
+        if (footprint.empty())
+            return value(u, v, p);
+
+        texture_cache::pin pyramid(*image);
+        if (pyramid->empty()) return color(0,1,1);
+
+        u = interval(0,1).clamp(u);
+        v = 1.0 - interval(0,1).clamp(v);
 
-        auto color_scale = 1.0 / 255.0;
-        return color(color_scale*pixel[0], color_scale*pixel[1], color_scale*pixel[2]);
+        // In image coordinates v runs the other way.
+        auto image_footprint = footprint;
+        image_footprint.dvdx = -footprint.dvdx;
+        image_footprint.dvdy = -footprint.dvdy;
+        return pyramid->filtered(u, v, image_footprint);
     }
 
   private:
-    rtw_image image;
+    texture_cache::entry* image;
 };
 
 class noise_texture : public texture {
@@ -0,0 +1,324 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "mipmap.h"
+#include "rtw_stb_image.h"
+#include "trace.h"
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+// Decoded image textures, shared by the whole process. Every image_texture naming the same file
+// (and texel layout) shares one entry, so a file is searched for and decoded once however many
+// textures and scenes use it. Only the mip pyramid stays resident: the decoded image is dropped
+// as soon as the pyramid is built from it. A pyramid that isn't resident is decoded by the first
+// lookup that needs it.
+//
+// Under a memory budget (set_memory_budget, or RT_TEXTURE_BUDGET_MB in the environment), each
+// decode past the budget evicts the least recently used pyramids, which are decoded again if
+// they're needed later. Eviction is by whole pyramid, since the image formats we read only
+// decode whole images. Recency is counted in decodes rather than lookups, so a lookup only
+// writes shared memory the first time it touches an entry after a decode.
+//
+// Without a budget, image_texture also queues its file for decoding when it is made, and a few
+// background threads (one per core) work through the queue while the scene goes on being built:
+// its meshes loaded, its BVH built. Decoding a scene's textures then takes about as long as the
+// slowest of them rather than their sum, and overlaps the rest of its setup. A lookup that gets
+// to a file before its decoder does decodes it itself, or waits for the decode in progress.
+// Under a budget, decodes wait for a lookup instead, so textures decoded ahead of need don't
+// evict each other, and textures a render never reaches cost nothing.
+//
+// Lookups take no lock and, without a budget, write no shared memory: nothing is ever evicted,
+// so a resident pyramid is simply read. Under a budget, a lookup pins its pyramid by announcing
+// the current epoch in a slot of its thread's own, a cache line apiece. An eviction unpublishes
+// the pyramid and retires it under a new epoch, and the retired pyramid is freed by a later
+// decode once no slot holds an older epoch, so no one waits on readers; lookups that arrive in
+// between find it missing and decode it again. The budget should be set before rendering starts,
+// since lookups made without one don't pin.
+class texture_cache {
+    class reader_slot;
+
+  public:
+    class pin;
+
+    class entry {
+      public:
+        entry(texture_cache& cache, const std::string& filename, texel_layout layout)
+          : cache(cache), filename(filename), layout(layout) {}
+
+        ~entry() { delete pyramid.load(); }
+
+        bool resident() const { return pyramid.load() != nullptr; }
+
+      private:
+        friend class texture_cache;
+        friend class pin;
+
+        texture_cache& cache;
+        std::string filename;      // As requested, then where it was found
+        texel_layout layout;
+        std::mutex decode_mutex;
+        std::atomic<const mipmap*> pyramid{nullptr};
+        std::atomic<unsigned long long> last_use{0};
+        size_t bytes = 0;          // Of the resident pyramid; guarded by the cache's mutex
+
+        void decode() {
+            std::lock_guard<std::mutex> lock(decode_mutex);
+            if (pyramid.load())
+                return;  // Another thread got here first
+
+            // Only the float data is needed to build the pyramid.
+            rtw_image image(filename.c_str(), false);
+            if (!image.path().empty())
+                filename = image.path();  // Later decodes skip the search
+            cache.publish(*this, new mipmap(image, layout));
+        }
+
+        // The pyramid, decoded now if it isn't resident. Under a budget it's pinned through the
+        // thread's slot, which stays announced until the pin ends.
+        const mipmap& acquire(reader_slot* slot) {
+            while (true) {
+                if (!slot) {
+                    if (auto p = pyramid.load(std::memory_order_acquire))
+                        return *p;
+                } else {
+                    slot->epoch.store(cache.epoch.load());
+                    if (auto p = pyramid.load()) {
+                        auto now = cache.clock.load(std::memory_order_relaxed);
+                        if (last_use.load(std::memory_order_relaxed) != now)
+                            last_use.store(now, std::memory_order_relaxed);
+                        return *p;
+                    }
+                    slot->epoch.store(0, std::memory_order_release);
+                }
+                decode();
+            }
+        }
+    };
+
+    // A pinned pyramid for the span of one lookup. A thread must not hold two pins at once.
+    class pin {
+      public:
+        pin(entry& e)
+          : slot(e.cache.pinning.load(std::memory_order_relaxed) ? &texture_cache::reader() : nullptr),
+            pyramid(e.acquire(slot)) {}
+        ~pin() { if (slot) slot->epoch.store(0, std::memory_order_release); }
+        pin(const pin&) = delete;
+        pin& operator=(const pin&) = delete;
+
+        const mipmap* operator->() const { return &pyramid; }
+
+      private:
+        reader_slot* slot;  // Null without a budget: nothing is evicted, so there's no pin
+        const mipmap& pyramid;
+    };
+
+    static texture_cache& global() {
+        static texture_cache cache;
+        return cache;
+    }
+
+    // The shared entry for a file, created on first request; nothing is decoded yet.
+    entry& find(const std::string& filename, texel_layout layout) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& e = entries[{filename, layout}];
+        if (!e)
+            e = std::make_unique<entry>(*this, filename, layout);
+        return *e;
+    }
+
+    // Queues the entry for a background decoder, unless a budget is set.
+    void prefetch(entry& e) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (budget > 0 || e.resident())
+            return;
+
+        queued.push_back(&e);
+
+        // Finished decoders are let go of here, rather than from their own threads.
+        decoders.erase(std::remove_if(decoders.begin(), decoders.end(), [](const auto& d) {
+            return d.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        }), decoders.end());
+
+        if (idle_decoders == 0 && decoders.size() < std::max(1u, std::thread::hardware_concurrency())) {
+            decoders.push_back(std::async(std::launch::async, [this] { decode_queued(); }));
+            idle_decoders++;
+        }
+    }
+
+    // Bytes of pyramids to keep resident before evicting; 0 for no limit.
+    void set_memory_budget(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        if (budget > 0)
+            pinning.store(true);
+        trim(nullptr);
+        reclaim();
+    }
+
+    size_t memory_budget() const { std::lock_guard<std::mutex> lock(mutex); return budget; }
+    size_t resident_bytes() const { std::lock_guard<std::mutex> lock(mutex); return resident; }
+    size_t decodes() const { std::lock_guard<std::mutex> lock(mutex); return decode_count; }
+    size_t evictions() const { std::lock_guard<std::mutex> lock(mutex); return eviction_count; }
+
+  private:
+    // Where a thread announces the epoch its current lookup began in, or 0 between lookups.
+    class alignas(64) reader_slot {
+      public:
+        std::atomic<unsigned long long> epoch{0};
+        bool claimed = false;  // By a live thread; guarded by the cache's mutex
+    };
+
+    // A thread's claim on a slot, given back when the thread exits.
+    class slot_claim {
+      public:
+        slot_claim(texture_cache& cache) : cache(cache) {
+            std::lock_guard<std::mutex> lock(cache.mutex);
+            for (auto& s : cache.slots)
+                if (!s.claimed) { slot = &s; break; }
+            if (!slot)
+                slot = &cache.slots.emplace_back();
+            slot->claimed = true;
+        }
+
+        ~slot_claim() {
+            std::lock_guard<std::mutex> lock(cache.mutex);
+            slot->claimed = false;
+        }
+
+        texture_cache& cache;
+        reader_slot* slot = nullptr;
+    };
+
+    class retired_pyramid {
+      public:
+        const mipmap* pyramid;
+        unsigned long long epoch;  // Lookups announced from this epoch on never saw it
+    };
+
+    mutable std::mutex mutex;
+    std::map<std::pair<std::string, texel_layout>, std::unique_ptr<entry>> entries;
+    std::atomic<unsigned long long> clock{0};  // Decodes so far, the unit of recency
+    size_t budget = 0;
+    size_t resident = 0;
+    size_t decode_count = 0;
+    size_t eviction_count = 0;
+    std::deque<entry*> queued;              // Waiting for a background decoder
+    std::vector<std::future<void>> decoders;
+    size_t idle_decoders = 0;               // Decoders not yet holding an entry
+    std::atomic<bool> pinning{false};       // Whether lookups pin; set with the first budget
+    std::atomic<unsigned long long> epoch{1};
+    std::deque<reader_slot> slots;          // Stable addresses as it grows
+    std::vector<retired_pyramid> retired;   // Evicted, waiting for older lookups to finish
+
+    texture_cache() {
+        auto megabytes = getenv("RT_TEXTURE_BUDGET_MB");
+        if (megabytes && *megabytes)
+            budget = size_t(std::strtoull(megabytes, nullptr, 10)) << 20;
+        pinning.store(budget > 0);
+    }
+
+    ~texture_cache() {
+        // Stop the decoders taking more work, then wait for the decodes in progress here, while
+        // the slots and retired list their publish() touches are still alive.
+        std::vector<std::future<void>> running;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.clear();
+            running.swap(decoders);
+        }
+        for (auto& d : running)
+            d.wait();
+
+        for (auto& r : retired)
+            delete r.pyramid;
+    }
+
+    static reader_slot& reader() {
+        thread_local slot_claim claim(global());
+        return *claim.slot;
+    }
+
+    void decode_queued() {
+        while (true) {
+            entry* e;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (queued.empty()) {
+                    idle_decoders--;
+                    return;
+                }
+                e = queued.front();
+                queued.pop_front();
+                idle_decoders--;
+            }
+
+            e->decode();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            idle_decoders++;
+        }
+    }
+
+    void publish(entry& e, const mipmap* pyramid) {
+        // Under the mutex, so an eviction never sees a pyramid whose bytes aren't counted yet.
+        std::lock_guard<std::mutex> lock(mutex);
+        e.bytes = pyramid->memory_bytes();
+        e.last_use.store(++clock);
+        e.pyramid.store(pyramid);
+        resident += e.bytes;
+        decode_count++;
+        trim(&e);
+        reclaim();
+    }
+
+    void trim(const entry* keep) {
+        // Evicts the least recently used pyramids, other than keep, until within budget.
+        while (budget > 0 && resident > budget) {
+            entry* victim = nullptr;
+            for (auto& [key, e] : entries) {
+                if (e.get() == keep || !e->resident() || e->bytes == 0)
+                    continue;
+                if (!victim || e->last_use.load() < victim->last_use.load())
+                    victim = e.get();
+            }
+            if (!victim)
+                return;
+
+            trace_scope trace("texture evict", "load");
+            auto p = victim->pyramid.exchange(nullptr);
+            retired.push_back({p, ++epoch});
+            resident -= victim->bytes;
+            victim->bytes = 0;
+            eviction_count++;
+        }
+    }
+
+    void reclaim() {
+        // Frees retired pyramids that no lookup in progress can still be reading: every slot is
+        // idle or was announced after the pyramid was unpublished.
+        retired.erase(std::remove_if(retired.begin(), retired.end(), [&](const retired_pyramid& r) {
+            for (const auto& s : slots) {
+                auto e = s.epoch.load();
+                if (e != 0 && e < r.epoch)
+                    return false;
+            }
+            delete r.pyramid;
+            return true;
+        }), retired.end());
+    }
+};
+
+#endif
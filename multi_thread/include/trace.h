@@ -0,0 +1,166 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Timeline tracing in the Chrome trace event format, viewable in chrome://tracing or Perfetto.
+//
+// Set RT_TRACE=trace.json in the environment (or call tracer::start) and wrap the phases to be
+// recorded in a trace_scope. Each thread appends finished events to its own fixed-size ring
+// buffer, so recording takes no locks; the oldest events are overwritten if a thread outlives
+// its buffer. When tracing is off, a trace_scope costs one relaxed atomic load.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+class trace_event {
+  public:
+    const char* name;   // Must outlive the tracer; string literals are the intended use
+    const char* category;
+    long long   start_ns;
+    long long   duration_ns;
+    long long   arg;    // Shown as args.index when not negative (the scanline, the frame, ...)
+};
+
+class trace_buffer {
+  public:
+    static constexpr size_t capacity = 1 << 16;
+
+    int thread_index;
+    std::vector<trace_event> events;
+    size_t written = 0;
+
+    trace_buffer(int thread_index) : thread_index(thread_index), events(capacity) {}
+
+    void push(const trace_event& e) {
+        events[written % capacity] = e;
+        written++;
+    }
+};
+
+class tracer {
+  public:
+    static bool enabled() { return instance().on.load(std::memory_order_relaxed); }
+
+    static void start(const std::string& filename) {
+        auto& t = instance();
+        t.filename = filename;
+        local_buffer();  // Claim thread 0 for the caller
+        t.on.store(true);
+    }
+
+    static void start_from_env() {
+        auto filename = getenv("RT_TRACE");
+        if (filename && *filename)
+            start(filename);
+    }
+
+    static long long now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - instance().epoch).count();
+    }
+
+    static void record(const trace_event& e) { local_buffer().push(e); }
+
+    static void finish() {
+        // Writes every thread's events to the file given to start. Call once the worker threads
+        // are done; their buffers are kept alive by the tracer after the threads exit.
+        auto& t = instance();
+        if (!t.on.exchange(false))
+            return;
+
+        std::lock_guard<std::mutex> lock(t.buffers_mutex);
+        std::ofstream file(t.filename);
+        file << "{\"traceEvents\": [\n";
+
+        bool first = true;
+        for (const auto& buffer : t.buffers) {
+            if (!first) file << ",\n";
+            first = false;
+            file << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+                 << buffer->thread_index << ", \"args\": {\"name\": \""
+                 << (buffer->thread_index == 0 ? std::string("main")
+                                               : "worker " + std::to_string(buffer->thread_index))
+                 << "\"}}";
+
+            auto count = std::min(buffer->written, trace_buffer::capacity);
+            for (size_t i = buffer->written - count; i < buffer->written; i++) {
+                const auto& e = buffer->events[i % trace_buffer::capacity];
+                file << ",\n{\"name\": \"" << e.name << "\", \"cat\": \"" << e.category
+                     << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->thread_index
+                     << ", \"ts\": " << e.start_ns / 1000.0
+                     << ", \"dur\": " << e.duration_ns / 1000.0;
+                if (e.arg >= 0)
+                    file << ", \"args\": {\"index\": " << e.arg << "}";
+                file << "}";
+            }
+        }
+
+        file << "\n]}\n";
+        std::clog << "Trace written to " << t.filename << "\n";
+    }
+
+  private:
+    std::atomic<bool> on{false};
+    std::string filename;
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    std::mutex buffers_mutex;
+    std::vector<std::shared_ptr<trace_buffer>> buffers;
+
+    static tracer& instance() {
+        static tracer t;
+        return t;
+    }
+
+    static trace_buffer& local_buffer() {
+        // The first event from a thread registers its buffer. Threads are numbered in the order
+        // they first record; start claims 0 for the thread that turned tracing on.
+        thread_local std::shared_ptr<trace_buffer> buffer = [] {
+            auto& t = instance();
+            std::lock_guard<std::mutex> lock(t.buffers_mutex);
+            auto b = std::make_shared<trace_buffer>(int(t.buffers.size()));
+            t.buffers.push_back(b);
+            return b;
+        }();
+        return *buffer;
+    }
+};
+
+
+// Records the time from construction to destruction. A null name records nothing.
+class trace_scope {
+  public:
+    trace_scope(const char* name, const char* category = "render", long long arg = -1)
+      : active(name != nullptr && tracer::enabled())
+    {
+        if (active) {
+            event.name = name;
+            event.category = category;
+            event.arg = arg;
+            event.start_ns = tracer::now_ns();
+        }
+    }
+
+    ~trace_scope() {
+        if (active) {
+            event.duration_ns = tracer::now_ns() - event.start_ns;
+            tracer::record(event);
+        }
+    }
+
+    trace_scope(const trace_scope&) = delete;
+    trace_scope& operator=(const trace_scope&) = delete;
+
+  private:
+    bool active;
+    trace_event event;
+};
+
+#endif
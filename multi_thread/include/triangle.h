@@ -3,6 +3,9 @@
 
 #include "hittable.h"
 #include "aabb.h"
+#include "material.h"
+
+#include <algorithm>
 
 class triangle : public hittable {
   public:
@@ -12,7 +15,8 @@ class triangle : public hittable {
         auto edge1 = v1 - v0;
         auto edge2 = v2 - v0;
         normal = unit_vector(cross(edge1, edge2));
-        
+        area = cross(edge1, edge2).length() / 2;
+
         set_bounding_box();
     }
 
@@ -33,7 +37,13 @@ class triangle : public hittable {
 
     aabb bounding_box() const override { return bbox; }
 
+    aabb clipped_bounding_box(const aabb& clip) const override {
+        return clipped_polygon_box({v0, v1, v2}, clip);
+    }
+
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        RT_STAT_INC(primitive_tests);
+
         // Möller–Trumbore intersection algorithm
         auto edge1 = v1 - v0;
         auto edge2 = v2 - v0;
@@ -61,21 +71,135 @@ class triangle : public hittable {
         if (!ray_t.contains(t))
             return false;
 
+        // Keep the barycentrics as the texture coordinates; the rest waits for finalize.
         rec.t = t;
-        rec.p = r.at(t);
-        rec.mat = mat;
-        rec.set_face_normal(r, normal);
         rec.u = u;
         rec.v = v;
+        rec.prim = this;
 
         return true;
     }
 
+    void finalize(const ray& r, hit_record& rec) const override {
+        rec.p = r.at(rec.t);
+        rec.mat = mat;
+        rec.set_face_normal(r, normal);
+        rec.dpdu = v1 - v0;
+        rec.dpdv = v2 - v0;
+    }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        hit_record rec;
+        if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+            return 0;
+
+        double solid_angle;
+        vec3 a, b, c;
+        if (use_spherical_sampling(origin, a, b, c, solid_angle))
+            return 1 / solid_angle;
+
+        auto distance_squared = rec.t * rec.t * direction.length_squared();
+        auto cosine = std::fabs(dot(direction, normal) / direction.length());
+        return distance_squared / (cosine * area);
+    }
+
+    vec3 random(const point3& origin) const override {
+        double solid_angle;
+        vec3 a, b, c;
+        if (use_spherical_sampling(origin, a, b, c, solid_angle))
+            return sample_spherical(a, b, c, solid_angle);
+
+        // Uniform over the area: folding the unit square onto the triangle.
+        auto s = random_double(), t = random_double();
+        if (s + t > 1) {
+            s = 1 - s;
+            t = 1 - t;
+        }
+        return v0 + s * (v1 - v0) + t * (v2 - v0) - origin;
+    }
+
+    double light_power() const override {
+        return mat ? area * luminance(mat->average_emission()) : 0;
+    }
+
+    emission_cone light_cone() const override {
+        emission_cone cone;
+        cone.axis = normal;
+        cone.cos_theta_o = 1;
+        return cone;
+    }
+
+    double surface_area() const { return area; }
+
   private:
     point3 v0, v1, v2;  // Vertices
     vec3 normal;        // Triangle normal
+    double area;
     shared_ptr<material> mat;
     aabb bbox;
+
+    // Spherical sampling pays where the triangle looks large from the origin, and area
+    // sampling's 1 / (cosine * area) swings widely across it. Below this solid angle the two
+    // are alike and the spherical formulas lose precision.
+    static constexpr double min_spherical_solid_angle = 3e-4;
+
+    static double angle_between(const vec3& p, const vec3& q) {
+        // Of unit vectors, accurately even when they nearly line up.
+        if (dot(p, q) < 0)
+            return pi - 2 * std::asin(std::fmin(1.0, (p + q).length() / 2));
+        return 2 * std::asin(std::fmin(1.0, (q - p).length() / 2));
+    }
+
+    bool use_spherical_sampling(const point3& origin, vec3& a, vec3& b, vec3& c,
+                                double& solid_angle) const {
+        // Projects the triangle onto the unit sphere around origin; its solid angle is the
+        // spherical excess of the projected triangle's angles. pdf_value and random make the
+        // same choice from the same origin, so they always agree on the strategy.
+        a = unit_vector(v0 - origin);
+        b = unit_vector(v1 - origin);
+        c = unit_vector(v2 - origin);
+
+        auto n_ab = cross(a, b), n_bc = cross(b, c), n_ca = cross(c, a);
+        if (n_ab.length_squared() == 0 || n_bc.length_squared() == 0 || n_ca.length_squared() == 0)
+            return false;
+        n_ab = unit_vector(n_ab);
+        n_bc = unit_vector(n_bc);
+        n_ca = unit_vector(n_ca);
+
+        auto alpha = angle_between(n_ab, -n_ca);
+        auto beta = angle_between(n_bc, -n_ab);
+        auto gamma = angle_between(n_ca, -n_bc);
+        solid_angle = alpha + beta + gamma - pi;
+
+        return solid_angle >= min_spherical_solid_angle && solid_angle < 2 * pi;
+    }
+
+    static vec3 sample_spherical(const vec3& a, const vec3& b, const vec3& c, double solid_angle) {
+        // Arvo's uniform sampling of a spherical triangle, as given in pbrt: a first uniform
+        // picks the sub-triangle a b c' with the chosen share of the area, a second picks a
+        // point along the arc from b to c'.
+        auto n_ab = unit_vector(cross(a, b));
+        auto n_ca = unit_vector(cross(c, a));
+        auto alpha = angle_between(n_ab, -n_ca);
+
+        auto area_pi = solid_angle * random_double() + pi;  // Sub-triangle area, plus pi
+        auto cos_alpha = std::cos(alpha), sin_alpha = std::sin(alpha);
+        auto sin_phi = std::sin(area_pi) * cos_alpha - std::cos(area_pi) * sin_alpha;
+        auto cos_phi = std::cos(area_pi) * cos_alpha + std::sin(area_pi) * sin_alpha;
+
+        auto k1 = cos_phi + cos_alpha;
+        auto k2 = sin_phi - sin_alpha * dot(a, b);
+        auto cos_b = (k2 + (k2 * cos_phi - k1 * sin_phi) * cos_alpha)
+                   / ((k2 * sin_phi + k1 * cos_phi) * sin_alpha);
+        cos_b = std::clamp(cos_b, -1.0, 1.0);
+        auto sin_b = std::sqrt(std::fmax(0.0, 1 - cos_b * cos_b));
+
+        auto c_prime = cos_b * a + sin_b * unit_vector(c - dot(c, a) * a);
+
+        auto cos_theta = 1 - random_double() * (1 - dot(c_prime, b));
+        auto sin_theta = std::sqrt(std::fmax(0.0, 1 - cos_theta * cos_theta));
+        return cos_theta * b + sin_theta * unit_vector(c_prime - dot(c_prime, b) * b);
+    }
 };
 
 #endif 
\ No newline at end of file
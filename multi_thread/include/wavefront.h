@@ -0,0 +1,197 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "color.h"
+#include "environment.h"
+#include "hittable.h"
+#include "material.h"
+#include "pdf.h"
+
+#include <utility>
+#include <vector>
+
+
+// Path state for a whole wave of paths, stored as one array per field so each stage only walks
+// the fields it needs.
+class path_queue {
+  public:
+    std::vector<point3> origin;
+    std::vector<vec3>   direction;
+    std::vector<double> time;
+    std::vector<color>  throughput;
+    std::vector<int>    sample;      // Which camera sample the path's radiance belongs to
+    std::vector<ray_differential> differential;
+
+    size_t size() const { return sample.size(); }
+
+    void reserve(size_t n) {
+        origin.reserve(n);
+        direction.reserve(n);
+        time.reserve(n);
+        throughput.reserve(n);
+        sample.reserve(n);
+        differential.reserve(n);
+    }
+
+    void clear() {
+        origin.clear();
+        direction.clear();
+        time.clear();
+        throughput.clear();
+        sample.clear();
+        differential.clear();
+    }
+
+    void push(const ray& r, const ray_differential& rd, const color& beta, int s) {
+        origin.push_back(r.origin());
+        direction.push_back(r.direction());
+        time.push_back(r.time());
+        throughput.push_back(beta);
+        sample.push_back(s);
+        differential.push_back(rd);
+    }
+
+    ray get_ray(size_t i) const { return ray(origin[i], direction[i], time[i]); }
+};
+
+
+// Traces many paths at once, one bounce at a time, in stages:
+//
+//   extend   Intersect every live path with the world.
+//   bin      Add the background to the paths that missed and group the rest by material kind.
+//   shade    Shade each group in its own loop, so one material's code stays hot at a time, and
+//            push the scattered rays of paths that survive into the next queue.
+//
+// Paths that end are simply not pushed, which keeps the next wave's queue compact. The result
+// matches camera::ray_color in expectation; only the order random numbers are drawn in differs.
+class wavefront_integrator {
+  public:
+    wavefront_integrator(const hittable& world, const hittable& lights, const color& background,
+                         const environment_light* environment, int max_depth,
+                         int russian_roulette_depth)
+      : world(world), lights(lights), background(background), environment(environment),
+        max_depth(max_depth), russian_roulette_depth(russian_roulette_depth)
+    {}
+
+    long long trace(const std::vector<ray>& camera_rays,
+                    const std::vector<ray_differential>& differentials, std::vector<color>& radiance) {
+        // Traces every camera ray (with its differentials) to completion, adding its radiance
+        // into the matching entry of `radiance`. Returns the number of rays intersected with the
+        // world.
+        long long rays = 0;
+
+        current.clear();
+        current.reserve(camera_rays.size());
+        next.reserve(camera_rays.size());
+        for (size_t i = 0; i < camera_rays.size(); i++)
+            current.push(camera_rays[i], differentials[i], color(1,1,1), int(i));
+
+        for (int bounce = 0; bounce < max_depth && current.size() > 0; bounce++) {
+            rays += current.size();
+
+            extend();
+            bin(radiance);
+
+            next.clear();
+            for (const auto& queue : bins)
+                shade(queue, bounce, radiance);
+
+            std::swap(current, next);
+        }
+
+        return rays;
+    }
+
+  private:
+    static const int kind_count = int(material_kind::other) + 1;
+
+    const hittable& world;
+    const hittable& lights;
+    color background;
+    const environment_light* environment;  // Replaces background where set
+    int max_depth;
+    int russian_roulette_depth;
+
+    path_queue current, next;
+    std::vector<hit_record> hits;
+    std::vector<char> did_hit;
+    std::vector<int> bins[kind_count];
+
+    void extend() {
+        auto n = current.size();
+        hits.resize(n);
+        did_hit.resize(n);
+
+        for (size_t i = 0; i < n; i++) {
+            auto r = current.get_ray(i);
+            did_hit[i] = world.hit(r, interval(0.001, infinity), hits[i]);
+            if (did_hit[i]) {
+                hits[i].finalize(r);
+                hits[i].compute_differentials(current.differential[i]);
+            }
+        }
+    }
+
+    void bin(std::vector<color>& radiance) {
+        for (auto& queue : bins)
+            queue.clear();
+
+        for (size_t i = 0; i < current.size(); i++) {
+            if (!did_hit[i])
+                radiance[current.sample[i]] += current.throughput[i]
+                    * (environment ? environment->value(current.get_ray(i).direction()) : background);
+            else
+                bins[int(hits[i].mat->kind())].push_back(int(i));
+        }
+    }
+
+    void shade(const std::vector<int>& queue, int bounce, std::vector<color>& radiance) {
+        for (int i : queue) {
+            const auto& rec = hits[i];
+            auto r_in = current.get_ray(i);
+            auto throughput = current.throughput[i];
+            auto& sample_radiance = radiance[current.sample[i]];
+
+            sample_radiance += throughput * rec.mat->emitted(r_in, rec, rec.u, rec.v, rec.p);
+
+            scatter_record srec;
+            if (!rec.mat->scatter(r_in, rec, srec))
+                continue;
+
+            ray scattered;
+            ray_differential differential;
+            if (srec.skip_pdf) {
+                throughput = throughput * srec.attenuation;
+                scattered = srec.skip_pdf_ray;
+                differential = specular_differential(r_in, rec, srec, current.differential[i]);
+            } else {
+                hittable_pdf light_pdf(lights, rec.p);
+                vec3 direction = (random_double() < 0.5) ? light_pdf.generate()
+                                                         : srec.pdf_ptr->generate();
+
+                scattered = ray(rec.p, direction, r_in.time());
+                auto pdf_value = 0.5 * light_pdf.value(direction) + 0.5 * srec.pdf_ptr->value(direction);
+                double scattering_pdf = rec.mat->scattering_pdf(r_in, rec, scattered);
+
+                if (pdf_value < 0.00001 || scattering_pdf < 0.00001)
+                    continue;
+
+                throughput = throughput * srec.attenuation * (scattering_pdf / pdf_value);
+            }
+
+            if (bounce + 1 >= russian_roulette_depth) {
+                auto survival = std::fmin(1.0, std::fmax(throughput.x(),
+                                               std::fmax(throughput.y(), throughput.z())));
+                if (survival < 1.0) {
+                    if (random_double() >= survival)
+                        continue;
+                    throughput /= survival;
+                }
+            }
+
+            next.push(scattered, differential, throughput, current.sample[i]);
+        }
+    }
+};
+
+#endif
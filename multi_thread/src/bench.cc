@@ -1,103 +1,377 @@
 #include "../include/rtweekend.h"
 
-#include "../include/hittable_list.h"
-#include "../include/sphere.h"
-#include "../include/camera.h"
-#include "../include/material.h"
-#include "../include/bvh.h"
+#include "../include/motion_bvh.h"
+#include "../include/sbvh.h"
+#include "../include/scenes.h"
 
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <string>
 #include <thread>
+#include <vector>
 
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+// Renders a fixed catalogue of scenes at a fixed seed and reduced size, and reports build time,
+// time to first pixel, ray throughput and peak memory for each one as JSON.
+//
+//   ./make/bench [--threads N] [--seed S] [--width W] [--spp N] [--scene NAME]...
+//                [--out results.json] [--compare baseline.json] [--threshold 0.05]
+//                [--wavefront | --packets] [--bvh none|median|sbvh|motion]
+//
+// Each scene runs in its own child process so that peak RSS is per scene rather than the
+// high-water mark of everything before it. With --compare, every scene is checked against the
+// baseline file and the exit status is nonzero if any of them regressed by more than the
+// threshold.
+//
+// --bvh wraps each scene's world in an acceleration structure (the scenes themselves use flat
+// lists); its build counts toward the scene's build time. --packets traces primary rays in
+// packets, which only a BVH traverses together, so it implies --bvh median unless another tree
+// is chosen. The mode and tree are recorded in the results.
 
-int main() {
 
-    // Get starting timepoint
-    auto start = std::chrono::high_resolution_clock::now();
+class bench_options {
+  public:
+    int threads = 0;
+    unsigned int seed = 1337;
+    int width = 160;
+    int samples_per_pixel = 16;
+    std::vector<std::string> scenes;
+    std::string out_file = "bench_results.json";
+    std::string compare_file;
+    double threshold = 0.05;
+    bool wavefront = false;
+    bool packets = false;
+    std::string bvh = "none";
 
-    unsigned int num_threads = std::thread::hardware_concurrency();
+    std::string mode() const { return wavefront ? "wavefront" : packets ? "packets" : "scalar"; }
+};
 
-    if (num_threads == 0) {
-        std::cout << "Unable to determine number of threads\n";
+class bench_result {
+  public:
+    std::string name;
+    double    build_seconds = 0;
+    double    first_pixel_seconds = 0;
+    double    render_seconds = 0;
+    long long rays = 0;
+    long long paths = 0;
+    double    rays_per_sec = 0;
+    double    paths_per_sec = 0;
+    long      peak_rss_kb = 0;
+    bool      ok = false;
+};
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;  // Kilobytes on Linux
+}
+
+static std::string to_json(const bench_result& r) {
+    // One scene per line, so that the compare mode can read results back line by line.
+    std::ostringstream out;
+    out << std::setprecision(9)
+        << "{\"name\": \"" << r.name << "\""
+        << ", \"build_seconds\": " << r.build_seconds
+        << ", \"first_pixel_seconds\": " << r.first_pixel_seconds
+        << ", \"render_seconds\": " << r.render_seconds
+        << ", \"rays\": " << r.rays
+        << ", \"paths\": " << r.paths
+        << ", \"rays_per_sec\": " << r.rays_per_sec
+        << ", \"paths_per_sec\": " << r.paths_per_sec
+        << ", \"peak_rss_kb\": " << r.peak_rss_kb
+        << "}";
+    return out.str();
+}
+
+static bool json_field(const std::string& line, const std::string& key, std::string& value) {
+    auto pos = line.find("\"" + key + "\":");
+    if (pos == std::string::npos) return false;
+
+    pos = line.find_first_not_of(' ', pos + key.size() + 3);
+    if (pos == std::string::npos) return false;
+
+    if (line[pos] == '"') {
+        auto end = line.find('"', pos + 1);
+        value = line.substr(pos + 1, end - pos - 1);
+    } else {
+        auto end = line.find_first_of(",}", pos);
+        value = line.substr(pos, end - pos);
+    }
+    return true;
+}
+
+static bool from_json(const std::string& line, bench_result& r) {
+    std::string value;
+    if (!json_field(line, "name", value)) return false;
+    r.name = value;
+
+    if (json_field(line, "build_seconds", value))       r.build_seconds = std::stod(value);
+    if (json_field(line, "first_pixel_seconds", value)) r.first_pixel_seconds = std::stod(value);
+    if (json_field(line, "render_seconds", value))      r.render_seconds = std::stod(value);
+    if (json_field(line, "rays", value))                r.rays = std::stoll(value);
+    if (json_field(line, "paths", value))               r.paths = std::stoll(value);
+    if (json_field(line, "rays_per_sec", value))        r.rays_per_sec = std::stod(value);
+    if (json_field(line, "paths_per_sec", value))       r.paths_per_sec = std::stod(value);
+    if (json_field(line, "peak_rss_kb", value))         r.peak_rss_kb = std::stol(value);
+    r.ok = true;
+    return true;
+}
+
+static std::vector<bench_result> read_results(const std::string& filename) {
+    std::vector<bench_result> results;
+    std::ifstream file(filename);
+
+    if (!file.is_open()) {
+        std::cerr << "ERROR: Could not open baseline: " << filename << std::endl;
+        return results;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        bench_result r;
+        if (from_json(line, r))
+            results.push_back(r);
+    }
+    return results;
+}
+
+
+static bench_result run_scene(const scene_entry& entry, const bench_options& opts) {
+    bench_result result;
+    result.name = entry.name;
+
+    // Scene construction draws random numbers too (star fields, Perlin tables), so seed first.
+    seed_random(opts.seed);
+
+    auto build_start = std::chrono::steady_clock::now();
+    scene s = entry.build();
+    if (opts.bvh == "median")
+        s.world = hittable_list(make_shared<bvh_node>(s.world));
+    else if (opts.bvh == "sbvh")
+        s.world = hittable_list(sbvh_builder(s.world).build());
+    else if (opts.bvh == "motion")
+        s.world = hittable_list(make_shared<motion_bvh>(s.world));
+    result.build_seconds = seconds_since(build_start);
+
+    s.cam.image_width = opts.width;
+    s.cam.samples_per_pixel = opts.samples_per_pixel;
+    s.cam.seed = opts.seed;
+    s.cam.output_file = "";
+    s.cam.wavefront = opts.wavefront;
+    s.cam.packets = opts.packets;
+
+    auto stats = s.render(opts.threads);
+
+    result.first_pixel_seconds = stats.first_pixel_seconds;
+    result.render_seconds = stats.render_seconds;
+    result.rays = stats.rays;
+    result.paths = stats.paths;
+    result.rays_per_sec = stats.rays / stats.render_seconds;
+    result.paths_per_sec = stats.paths / stats.render_seconds;
+    result.peak_rss_kb = peak_rss_kb();
+    result.ok = true;
+    return result;
+}
+
+static bench_result run_isolated(const scene_entry& entry, const bench_options& opts) {
+    // Run the scene in a child process and read its JSON line back through a pipe.
+    int fds[2];
+    if (pipe(fds) != 0)
+        return run_scene(entry, opts);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return run_scene(entry, opts);
     }
-    else
-    {
-        std::cout << "We able to rip:" << num_threads << " threads!!\n";
+
+    if (pid == 0) {
+        close(fds[0]);
+        auto line = to_json(run_scene(entry, opts)) + "\n";
+        auto written = write(fds[1], line.data(), line.size());
+        close(fds[1]);
+        _exit(written == ssize_t(line.size()) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    std::string line;
+    char buffer[512];
+    ssize_t n;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+        line.append(buffer, n);
+    close(fds[0]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    bench_result result;
+    result.name = entry.name;
+    if (!from_json(line, result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "ERROR: Scene '" << entry.name << "' did not finish.\n";
+        result.ok = false;
     }
+    return result;
+}
+
+
+static int compare(const std::vector<bench_result>& current, const std::string& baseline_file,
+                   double threshold, const std::vector<std::string>& selected) {
+    // Throughput must not drop and build time must not grow by more than the threshold. Build
+    // times under a few milliseconds are too noisy to judge, so those are only reported. A scene
+    // that failed, or that the baseline has but this run skipped without being asked to, is a
+    // regression too.
+    auto baseline = read_results(baseline_file);
+    int regressions = 0;
 
-    hittable_list world;
-
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                } else {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
+    std::cout << "\nComparison against " << baseline_file
+              << " (threshold " << threshold * 100 << "%):\n";
+
+    for (const auto& cur : current) {
+        const bench_result* base = nullptr;
+        for (const auto& b : baseline)
+            if (b.name == cur.name) base = &b;
+
+        if (!cur.ok) {
+            std::cout << "  " << std::left << std::setw(30) << cur.name << " failed  REGRESSION\n";
+            regressions++;
+            continue;
+        }
+
+        // A baseline that failed itself recorded zeros, which there's nothing to compare with.
+        if (!base || !(base->rays_per_sec > 0)) {
+            std::cout << "  " << std::left << std::setw(30) << cur.name << " (no baseline)\n";
+            continue;
         }
+
+        auto change = [](double now, double before) { return before > 0 ? now / before - 1.0 : 0.0; };
+        auto throughput = change(cur.rays_per_sec, base->rays_per_sec);
+        auto build = change(cur.build_seconds, base->build_seconds);
+
+        bool slower = throughput < -threshold;
+        bool slower_build = build > threshold && cur.build_seconds - base->build_seconds > 0.005;
+
+        std::cout << "  " << std::left << std::setw(30) << cur.name << std::right << std::fixed
+                  << std::setprecision(1)
+                  << " rays/sec " << std::setw(7) << throughput * 100 << "%"
+                  << "  build " << std::setw(7) << build * 100 << "%"
+                  << "  rss " << std::setw(7)
+                  << change(double(cur.peak_rss_kb), double(base->peak_rss_kb)) * 100 << "%";
+
+        if (slower || slower_build) {
+            std::cout << "  REGRESSION";
+            regressions++;
+        }
+        std::cout << "\n";
     }
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+    for (const auto& b : baseline) {
+        bool ran = std::any_of(current.begin(), current.end(),
+                               [&](const bench_result& r) { return r.name == b.name; });
+        bool skipped = !selected.empty()
+                    && std::find(selected.begin(), selected.end(), b.name) == selected.end();
+        if (ran || skipped)
+            continue;
 
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+        std::cout << "  " << std::left << std::setw(30) << b.name << " missing  REGRESSION\n";
+        regressions++;
+    }
 
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    std::cout << regressions << " regression(s)\n";
+    return regressions == 0 ? 0 : 1;
+}
 
 
-    camera cam;
+int main(int argc, char* argv[]) {
+    bench_options opts;
 
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
 
-    cam.vfov     = 20;
-    cam.lookfrom = point3(13,2,3);
-    cam.lookat   = point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
+        if (arg == "--threads" && has_value)        opts.threads = std::stoi(argv[++i]);
+        else if (arg == "--seed" && has_value)      opts.seed = std::stoul(argv[++i]);
+        else if (arg == "--width" && has_value)     opts.width = std::stoi(argv[++i]);
+        else if (arg == "--spp" && has_value)       opts.samples_per_pixel = std::stoi(argv[++i]);
+        else if (arg == "--scene" && has_value)     opts.scenes.push_back(argv[++i]);
+        else if (arg == "--out" && has_value)       opts.out_file = argv[++i];
+        else if (arg == "--compare" && has_value)   opts.compare_file = argv[++i];
+        else if (arg == "--threshold" && has_value) opts.threshold = std::stod(argv[++i]);
+        else if (arg == "--wavefront")              opts.wavefront = true;
+        else if (arg == "--packets")                opts.packets = true;
+        else if (arg == "--bvh" && has_value)       opts.bvh = argv[++i];
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--threads N] [--seed S] [--width W] [--spp N]"
+                      << " [--scene NAME]... [--out FILE] [--compare BASELINE] [--threshold F]"
+                      << " [--wavefront | --packets] [--bvh none|median|sbvh|motion]\n";
+            return 2;
+        }
+    }
 
-    cam.defocus_angle = 0.6;
-    cam.focus_dist    = 10.0;
+    if (opts.wavefront && opts.packets) {
+        std::cerr << "ERROR: --wavefront and --packets are different render modes; pick one.\n";
+        return 2;
+    }
+    if (opts.packets && opts.bvh == "none")
+        opts.bvh = "median";
 
-    cam.render(world, num_threads);
+    if (opts.threads <= 0)
+        opts.threads = std::max(1u, std::thread::hardware_concurrency());
 
-    // Get ending timepoint
-    auto stop = std::chrono::high_resolution_clock::now();
- 
-    // Get duration. Substart timepoints to 
-    // get duration. To cast it to proper unit
-    // use duration cast method
-    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
- 
-    std::cout << "Time taken by function: "
-         << duration.count() << " microseconds" << std::endl;
- 
-    return 0;
+    std::vector<bench_result> results;
 
+    for (const auto& entry : scene_catalogue()) {
+        if (!opts.scenes.empty()
+            && std::find(opts.scenes.begin(), opts.scenes.end(), entry.name) == opts.scenes.end())
+            continue;
 
+        std::clog << "Benchmarking " << entry.name << "...\n";
+        results.push_back(run_isolated(entry, opts));
+    }
+
+    std::ofstream out(opts.out_file);
+    out << "{\"threads\": " << opts.threads << ", \"seed\": " << opts.seed
+        << ", \"width\": " << opts.width << ", \"samples_per_pixel\": " << opts.samples_per_pixel
+        << ", \"mode\": \"" << opts.mode() << "\", \"bvh\": \"" << opts.bvh << "\""
+        << ", \"scenes\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+        out << to_json(results[i]) << (i + 1 < results.size() ? ",\n" : "\n");
+    out << "]}\n";
+    out.close();
+
+    std::cout << "\n" << std::left << std::setw(30) << "scene" << std::right
+              << std::setw(10) << "build s" << std::setw(12) << "1st px s" << std::setw(10) << "render s"
+              << std::setw(14) << "Mrays/s" << std::setw(14) << "Kpaths/s" << std::setw(12) << "peak MB\n";
+    for (const auto& r : results) {
+        std::cout << std::left << std::setw(30) << r.name << std::right << std::fixed;
+        if (!r.ok) {
+            std::cout << "  failed\n";
+            continue;
+        }
+        std::cout << std::setprecision(3)
+                  << std::setw(10) << r.build_seconds
+                  << std::setw(12) << r.first_pixel_seconds
+                  << std::setw(10) << r.render_seconds
+                  << std::setw(14) << r.rays_per_sec / 1e6
+                  << std::setw(14) << r.paths_per_sec / 1e3
+                  << std::setw(11) << std::setprecision(1) << r.peak_rss_kb / 1024.0 << "\n";
+    }
+    std::cout << "Results written to " << opts.out_file << "\n";
+
+    if (!opts.compare_file.empty())
+        return compare(results, opts.compare_file, opts.threshold, opts.scenes);
+
+    return 0;
 }
@@ -0,0 +1,413 @@
+#include "../include/rtweekend.h"
+
+#include "../include/aabb.h"
+#include "../include/baked_texture.h"
+#include "../include/bvh.h"
+#include "../include/compressed_bvh.h"
+#include "../include/grid_medium.h"
+#include "../include/sbvh.h"
+#include "../include/hittable_list.h"
+#include "../include/material.h"
+#include "../include/mesh.h"
+#include "../include/perlin.h"
+#include "../include/quad.h"
+#include "../include/sphere.h"
+#include "../include/texture.h"
+#include "../include/triangle.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Times the intersection kernels in isolation: sphere, quad, triangle and aabb hits, and whole
+// bvh_node traversals over the bundled meshes. Every kernel is run against three reproducible
+// ray sets:
+//
+//   primary  A coherent pinhole grid aimed at the target, traced in scanline order.
+//   diffuse  Random origins inside the target's bounds with random directions, like the
+//            incoherent bounces after a diffuse hit.
+//   shadow   Random origins inside the bounds aimed at a fixed light above the target, with the
+//            interval clipped short of the light.
+//
+// BVH kernels are also timed in ray_packet form (bvh:NAME/packet), eight consecutive rays of
+// the set per packet, as compressed_bvh trees with 8- and 16-bit boxes (bvh:NAME/q8 and
+// bvh:NAME/q16), and as a spatial-split tree from sbvh_builder (bvh:NAME/sbvh).
+//
+// Texture kernels (tex:NAME/LAYOUT) hit a unit sphere mapped with one of the bundled earth
+// images and take a bilinear lookup at every hit, with the texels stored in rows or in tiles, so
+// the ray sets' coherence carries over into the texture accesses.
+//
+// Noise kernels evaluate marble's seven-octave turbulence at every sphere hit, one point at a
+// time (noise:turb) or all of a set's hits in one batch call (noise:turb/batch). The marble
+// kernels shade every sphere hit with the marble texture, then with it baked over the sphere's
+// box (marble/solid) and over its texture coordinates (marble/surface).
+//
+// Medium kernels delta-track rays through a ball of noise smoke on a 64^3 grid, like the
+// volume demo's (medium:smoke), and estimate their transmittance through it by ratio tracking
+// (medium:smoke/transmittance); a hit there is a ray the smoke dims at all.
+//
+//   ./make/microbench [--rays N] [--seed S] [--min-time SECONDS] [--kernel NAME]...
+
+
+class ray_set {
+  public:
+    std::string name;
+    std::vector<ray> rays;
+    std::vector<interval> intervals;
+};
+
+class kernel_result {
+  public:
+    std::string kernel;
+    std::string rays;
+    double ns_per_ray = 0;
+    double hits_fraction = 0;
+};
+
+
+static point3 random_in_box(const aabb& box) {
+    return point3(random_double(box.x.min, box.x.max),
+                  random_double(box.y.min, box.y.max),
+                  random_double(box.z.min, box.z.max));
+}
+
+static std::vector<ray_set> make_ray_sets(const aabb& bounds, int count, unsigned int seed) {
+    seed_random(seed);
+
+    point3 center((bounds.x.min + bounds.x.max) / 2,
+                  (bounds.y.min + bounds.y.max) / 2,
+                  (bounds.z.min + bounds.z.max) / 2);
+    vec3 extent(bounds.x.size(), bounds.y.size(), bounds.z.size());
+    auto radius = extent.length() / 2;
+
+    std::vector<ray_set> sets(3);
+
+    // Primary rays: a square grid on an image plane seen from three radii away.
+    sets[0].name = "primary";
+    int side = int(std::sqrt(double(count)));
+    point3 eye = center + vec3(0.3, 0.2, 1.0) * (3 * radius);
+    vec3 w = unit_vector(eye - center);
+    vec3 u = unit_vector(cross(vec3(0,1,0), w));
+    vec3 v = cross(w, u);
+    for (int j = 0; j < side; j++) {
+        for (int i = 0; i < side; i++) {
+            auto px = (i + 0.5) / side - 0.5;
+            auto py = (j + 0.5) / side - 0.5;
+            vec3 dir = (center - eye) + (2.2 * radius) * (px * u - py * v);
+            sets[0].rays.push_back(ray(eye, dir));
+            sets[0].intervals.push_back(interval(0.001, infinity));
+        }
+    }
+
+    // Diffuse bounces: no coherence in origin or direction.
+    sets[1].name = "diffuse";
+    for (int i = 0; i < count; i++) {
+        sets[1].rays.push_back(ray(random_in_box(bounds), random_unit_vector()));
+        sets[1].intervals.push_back(interval(0.001, infinity));
+    }
+
+    // Shadow rays: unnormalized directions toward an off-axis light, so t in (0,1) spans the
+    // segment.
+    sets[2].name = "shadow";
+    point3 light = center + vec3(0.6, 2.0, 0.8) * radius;
+    for (int i = 0; i < count; i++) {
+        auto origin = random_in_box(bounds);
+        sets[2].rays.push_back(ray(origin, light - origin));
+        sets[2].intervals.push_back(interval(0.001, 0.999));
+    }
+
+    return sets;
+}
+
+// Traces a whole ray set and returns how many rays hit.
+using set_kernel = std::function<long long(const ray_set&)>;
+
+static set_kernel per_ray(const std::function<bool(const ray&, interval)>& hit) {
+    return [hit](const ray_set& set) {
+        long long hits = 0;
+        for (size_t i = 0; i < set.rays.size(); i++)
+            hits += hit(set.rays[i], set.intervals[i]);
+        return hits;
+    };
+}
+
+static set_kernel per_packet(const hittable* object) {
+    // Consecutive rays of the set form each packet, which keeps the primary grid's coherence.
+    return [object](const ray_set& set) {
+        long long hits = 0;
+        for (size_t i = 0; i < set.rays.size(); i += ray_packet::width) {
+            ray_packet packet;
+            hit_record recs[ray_packet::width];
+            int lanes = int(std::min(set.rays.size() - i, size_t(ray_packet::width)));
+            for (int lane = 0; lane < lanes; lane++)
+                packet.set(lane, set.rays[i + lane], set.intervals[i + lane]);
+            hits += ray_packet::count(object->hit_packet(packet, (1u << lanes) - 1, recs));
+        }
+        return hits;
+    };
+}
+
+static kernel_result time_kernel(const std::string& kernel, const ray_set& set, double min_time,
+                                 const set_kernel& trace) {
+    // Repeats the whole ray set until at least min_time has passed and keeps the fastest pass,
+    // which is the one least disturbed by the rest of the machine.
+    using clock = std::chrono::steady_clock;
+
+    kernel_result result;
+    result.kernel = kernel;
+    result.rays = set.name;
+
+    double best = infinity;
+    double total = 0;
+    long long hits = 0;
+
+    for (int pass = 0; pass < 3 || total < min_time; pass++) {
+        auto start = clock::now();
+        hits = trace(set);
+        auto elapsed = std::chrono::duration<double>(clock::now() - start).count();
+
+        best = std::fmin(best, elapsed);
+        total += elapsed;
+    }
+
+    result.ns_per_ray = best * 1e9 / set.rays.size();
+    result.hits_fraction = double(hits) / set.rays.size();
+    return result;
+}
+
+
+int main(int argc, char* argv[]) {
+    int ray_count = 1 << 16;
+    unsigned int seed = 7;
+    double min_time = 0.25;
+    std::vector<std::string> only;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--rays" && has_value)          ray_count = std::stoi(argv[++i]);
+        else if (arg == "--seed" && has_value)     seed = std::stoul(argv[++i]);
+        else if (arg == "--min-time" && has_value) min_time = std::stod(argv[++i]);
+        else if (arg == "--kernel" && has_value)   only.push_back(argv[++i]);
+        else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--rays N] [--seed S] [--min-time SECONDS] [--kernel NAME]...\n";
+            return 2;
+        }
+    }
+
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+    // Single primitives, each sized to roughly the unit cube.
+    auto the_sphere   = make_shared<sphere>(point3(0,0,0), 1.0, mat);
+    auto the_quad     = make_shared<quad>(point3(-1,-1,0), vec3(2,0,0), vec3(0,2,0), mat);
+    auto the_triangle = make_shared<triangle>(point3(-1,-1,0), point3(1,-1,0), point3(0,1,0), mat);
+    auto the_box      = aabb(point3(-1,-1,-1), point3(1,1,1));
+
+    class target {
+      public:
+        std::string name;
+        aabb bounds;
+        set_kernel trace;
+    };
+
+    auto selected = [&](const std::string& name) {
+        // --kernel bvh:cup selects both bvh:cup and bvh:cup/packet.
+        if (only.empty()) return true;
+        for (const auto& prefix : only)
+            if (name.compare(0, prefix.size(), prefix) == 0) return true;
+        return false;
+    };
+
+    std::vector<target> targets;
+    targets.push_back({"sphere", the_sphere->bounding_box(), per_ray(
+        [&](const ray& r, interval t) { hit_record rec; return the_sphere->hit(r, t, rec); })});
+    targets.push_back({"quad", aabb(point3(-1,-1,-1), point3(1,1,1)), per_ray(
+        [&](const ray& r, interval t) { hit_record rec; return the_quad->hit(r, t, rec); })});
+    targets.push_back({"triangle", aabb(point3(-1,-1,-1), point3(1,1,1)), per_ray(
+        [&](const ray& r, interval t) { hit_record rec; return the_triangle->hit(r, t, rec); })});
+    targets.push_back({"aabb", aabb(point3(-2,-2,-2), point3(2,2,2)), per_ray(
+        [&](const ray& r, interval t) { return the_box.hit(r, t); })});
+
+    // Whole-BVH traversals over the bundled meshes.
+    std::vector<shared_ptr<hittable>> bvhs;
+    for (auto filename : {"meshes/Nefertiti.obj", "meshes/cup.obj", "meshes/StanfordBunny.obj"}) {
+        std::string name = filename;
+        name = "bvh:" + name.substr(name.find('/') + 1, name.find('.') - name.find('/') - 1);
+        if (!selected(name))
+            continue;
+
+        mesh m(filename, mat);
+        if (m.faces().empty())
+            continue;
+
+        hittable_list triangles;
+        for (const auto& tri : m.faces())
+            triangles.add(tri);
+
+        auto build_start = std::chrono::steady_clock::now();
+        auto tree = make_shared<bvh_node>(triangles);
+        auto build_seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count();
+        std::clog << name << ": " << m.faces().size() << " triangles, BVH built in "
+                  << build_seconds * 1000 << " ms\n";
+
+        bvhs.push_back(tree);
+        auto node = bvhs.back().get();
+        targets.push_back({name, tree->bounding_box(), per_ray(
+            [node](const ray& r, interval t) { hit_record rec; return node->hit(r, t, rec); })});
+        targets.push_back({name + "/packet", tree->bounding_box(), per_packet(node)});
+
+        auto q8 = make_shared<compressed_bvh<std::uint8_t>>(triangles);
+        auto q16 = make_shared<compressed_bvh<std::uint16_t>>(triangles);
+        std::clog << name << ": compressed nodes take " << q8->memory_bytes() / 1024 << " KiB (q8), "
+                  << q16->memory_bytes() / 1024 << " KiB (q16); a bvh_node is "
+                  << sizeof(bvh_node) << " bytes before its shared_ptr blocks\n";
+        bvhs.push_back(q8);
+        bvhs.push_back(q16);
+        targets.push_back({name + "/q8", tree->bounding_box(), per_ray(
+            [q8 = q8.get()](const ray& r, interval t) { hit_record rec; return q8->hit(r, t, rec); })});
+        targets.push_back({name + "/q16", tree->bounding_box(), per_ray(
+            [q16 = q16.get()](const ray& r, interval t) { hit_record rec; return q16->hit(r, t, rec); })});
+
+        build_start = std::chrono::steady_clock::now();
+        sbvh_builder builder(triangles);
+        auto spatial = builder.build();
+        build_seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count();
+        std::clog << name << ": SBVH built in " << build_seconds * 1000 << " ms with "
+                  << builder.duplicates() << " duplicate references\n";
+        bvhs.push_back(spatial);
+        targets.push_back({name + "/sbvh", tree->bounding_box(), per_ray(
+            [s = spatial.get()](const ray& r, interval t) { hit_record rec; return s->hit(r, t, rec); })});
+    }
+
+    // Texture lookups behind sphere hits, in each texel layout.
+    std::vector<shared_ptr<texture>> textures;
+    for (auto filename : {"8081_earthmap2k.jpg", "8081_earthbump4k.jpg"}) {
+        std::string name = filename;
+        name = "tex:" + name.substr(name.find('_') + 1, name.find('.') - name.find('_') - 1);
+
+        for (auto layout : {texel_layout::scanline, texel_layout::tiled}) {
+            auto kernel = name + (layout == texel_layout::tiled ? "/tiled" : "/scanline");
+            if (!selected(kernel))
+                continue;
+
+            auto tex = make_shared<image_texture>(filename, layout);
+            tex->value(0, 0, point3(0,0,0));  // Decode now rather than in the first timing
+            textures.push_back(tex);
+            targets.push_back({kernel, the_sphere->bounding_box(), per_ray(
+                [&the_sphere, tex = tex.get()](const ray& r, interval t) {
+                    hit_record rec;
+                    if (!the_sphere->hit(r, t, rec))
+                        return false;
+                    rec.finalize(r);
+
+                    // A footprint of about a texel keeps the lookup bilinear on the full image.
+                    texture_footprint footprint;
+                    footprint.dudx = footprint.dvdy = 1e-4;
+                    auto c = tex->filtered_value(rec.u, rec.v, rec.p, footprint);
+                    return c.x() >= 0;
+                })});
+        }
+    }
+
+    // Marble turbulence behind sphere hits, a point at a time and through the batch call.
+    perlin noise;
+    targets.push_back({"noise:turb", the_sphere->bounding_box(), per_ray(
+        [&](const ray& r, interval t) {
+            hit_record rec;
+            if (!the_sphere->hit(r, t, rec))
+                return false;
+            rec.finalize(r);
+            return noise.turb(4 * rec.p, 7) >= 0;
+        })});
+    targets.push_back({"noise:turb/batch", the_sphere->bounding_box(), [&](const ray_set& set) {
+        std::vector<point3> points;
+        for (size_t i = 0; i < set.rays.size(); i++) {
+            hit_record rec;
+            if (the_sphere->hit(set.rays[i], set.intervals[i], rec)) {
+                rec.finalize(set.rays[i]);
+                points.push_back(4 * rec.p);
+            }
+        }
+
+        std::vector<double> values(points.size());
+        noise.turb(points.data(), values.data(), points.size(), 7);
+        return (long long)std::count_if(values.begin(), values.end(), [](double v) { return v >= 0; });
+    }});
+
+    // The marble texture itself, then baked over the sphere's box and over its (u,v) square.
+    // Each kernel name is tested in full, since --kernel marble/solid doesn't select "marble".
+    const std::string marble_kernels[] = {"marble", "marble/solid", "marble/surface"};
+    if (std::any_of(std::begin(marble_kernels), std::end(marble_kernels), selected)) {
+        auto marble = make_shared<noise_texture>(4);
+        auto baked_solid = make_shared<baked_texture>(marble, the_sphere->bounding_box(), 128);
+        auto baked_surface = make_shared<baked_texture>(marble, 1024, 512,
+            [s = the_sphere.get()](double u, double v) { return s->surface_point(u, v); });
+        textures.insert(textures.end(), {marble, baked_solid, baked_surface});
+
+        texture* marble_textures[] = {marble.get(), baked_solid.get(), baked_surface.get()};
+        for (int k = 0; k < 3; k++) {
+            auto kernel = marble_kernels[k];
+            if (!selected(kernel))
+                continue;
+
+            targets.push_back({kernel, the_sphere->bounding_box(), per_ray(
+                [&the_sphere, tex = marble_textures[k]](const ray& r, interval t) {
+                    hit_record rec;
+                    if (!the_sphere->hit(r, t, rec))
+                        return false;
+                    rec.finalize(r);
+                    return tex->value(rec.u, rec.v, rec.p).x() >= 0;
+                })});
+        }
+    }
+
+    // Noise smoke, tracked through its majorant grid.
+    if (selected("medium:smoke") || selected("medium:smoke/transmittance")) {
+        auto smoke_box = aabb(point3(-1,-1,-1), point3(1,1,1));
+        density_grid smoke(smoke_box, 64, 64, 64, [&](const point3& p) {
+            auto falloff = 1 - p.length();
+            return falloff > 0 ? falloff * std::fmax(0.0, noise.turb(1.5 * p, 5) - 0.2) : 0.0;
+        });
+        auto medium = make_shared<grid_medium>(smoke, 60.0, color(0.5, 0.5, 0.5));
+
+        targets.push_back({"medium:smoke", smoke_box, per_ray(
+            [medium](const ray& r, interval t) {
+                hit_record rec;
+                return medium->hit(r, t, rec);
+            })});
+        targets.push_back({"medium:smoke/transmittance", smoke_box, per_ray(
+            [medium](const ray& r, interval t) {
+                return medium->transmittance(r, t) < 1;
+            })});
+    }
+
+    std::vector<kernel_result> results;
+    for (const auto& t : targets) {
+        if (!selected(t.name))
+            continue;
+
+        for (const auto& set : make_ray_sets(t.bounds, ray_count, seed))
+            results.push_back(time_kernel(t.name, set, min_time, t.trace));
+    }
+
+    std::cout << std::left << std::setw(28) << "kernel" << std::setw(10) << "rays" << std::right
+              << std::setw(12) << "ns/ray" << std::setw(16) << "Misect/s" << std::setw(10)
+              << "hit %" << "\n";
+    for (const auto& r : results) {
+        std::cout << std::left << std::setw(28) << r.kernel << std::setw(10) << r.rays
+                  << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << r.ns_per_ray
+                  << std::setw(16) << 1e3 / r.ns_per_ray
+                  << std::setw(10) << std::setprecision(1) << r.hits_fraction * 100 << "\n";
+    }
+
+    return 0;
+}
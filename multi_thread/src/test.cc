@@ -0,0 +1,287 @@
+#include "../include/rtweekend.h"
+
+#include "../include/environment.h"
+#include "../include/hittable.h"
+#include "../include/hittable_list.h"
+#include "../include/light_tree.h"
+#include "../include/material.h"
+#include "../include/mesh.h"
+#include "../include/mipmap.h"
+#include "../include/motion_bvh.h"
+#include "../include/onb.h"
+#include "../include/quad.h"
+#include "../include/sphere.h"
+#include "../include/triangle.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+
+// Checks of behaviour that's easy to break without a render showing it. Each failed check is
+// reported, and the exit status is the number of failures.
+//
+//   make test
+
+
+static int failures = 0;
+
+static void check(bool passed, const char* what) {
+    if (!passed) {
+        std::cerr << "FAILED: " << what << "\n";
+        failures++;
+    }
+}
+
+// The integral of f over the directions from origin that can reach bounds, estimated from n
+// uniform ones: those in the cone around its bounding sphere, or all of them from inside it.
+template <typename integrand>
+static double integrate_directions(const point3& origin, const aabb& bounds, int n, integrand f) {
+    auto center = point3((bounds.x.min + bounds.x.max) / 2, (bounds.y.min + bounds.y.max) / 2,
+                         (bounds.z.min + bounds.z.max) / 2);
+    auto radius = vec3(bounds.x.size(), bounds.y.size(), bounds.z.size()).length() / 2;
+    auto to_center = center - origin;
+    auto d2 = to_center.length_squared();
+    auto cos_max = d2 > radius * radius ? std::sqrt(1 - radius * radius / d2) : -1.0;
+    onb uvw(d2 > 0 ? to_center : vec3(0,0,1));
+
+    double sum = 0;
+    for (int k = 0; k < n; k++) {
+        auto cos_theta = 1 - random_double() * (1 - cos_max);
+        auto sin_theta = std::sqrt(std::fmax(0.0, 1 - cos_theta * cos_theta));
+        auto phi = 2 * pi * random_double();
+        sum += f(uvw.transform(vec3(std::cos(phi) * sin_theta, std::sin(phi) * sin_theta, cos_theta)));
+    }
+    return 2 * pi * (1 - cos_max) * sum / n;
+}
+
+// Monte Carlo checks of a light sampler's pdf against its random(), from origin: the pdf
+// integrated over the sphere of directions, which should come to 1, and the mean of 1/pdf over
+// its own samples, which should come to the solid angle those samples can reach.
+static double integrated_pdf(const hittable& sampler, const point3& origin, int n) {
+    return integrate_directions(origin, sampler.bounding_box(), n,
+                                [&](const vec3& d) { return sampler.pdf_value(origin, d); });
+}
+
+static double mean_inverse_pdf(const hittable& sampler, const point3& origin, int n) {
+    // Samples the pdf says can't happen are a mismatch, unless they're the odd one landing on
+    // an edge that the hit test rounds away.
+    double sum = 0;
+    int impossible = 0;
+    for (int k = 0; k < n; k++) {
+        auto pdf = sampler.pdf_value(origin, sampler.random(origin));
+        if (pdf > 0)
+            sum += 1 / pdf;
+        else
+            impossible++;
+    }
+    return impossible <= n / 100000 ? sum / n : infinity;
+}
+
+// The solid angle of the directions from origin in which target is hit.
+static double solid_angle(const hittable& target, const point3& origin, int n) {
+    return integrate_directions(origin, target.bounding_box(), n, [&](const vec3& d) {
+        hit_record rec;
+        return target.hit(ray(origin, d), interval(0.001, infinity), rec) ? 1.0 : 0.0;
+    });
+}
+
+static void test_one_knot_moving() {
+    // A path of a single offset is a fixed translation: one motion segment, not zero, so the
+    // least common multiples above it and motion_bvh's segment arithmetic stay defined.
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    auto ball = make_shared<moving>(make_shared<sphere>(point3(0,0,0), 1.0, mat),
+                                    std::vector<vec3>{vec3(2,0,0)});
+    check(ball->motion_segments() == 1, "one-knot moving has one motion segment");
+
+    hittable_list world;
+    world.add(ball);
+    world.add(make_shared<moving>(make_shared<sphere>(point3(0,0,0), 0.5, mat),
+                                  std::vector<vec3>{vec3(-3,0,0), vec3(-3,1,0), vec3(-3,2,0)}));
+    check(world.motion_segments() == 2, "list of one- and two-segment paths has two segments");
+
+    motion_bvh tree(world);
+    hit_record rec;
+    for (auto time : {0.0, 0.5, 1.0}) {
+        ray r(point3(2,0,5), vec3(0,0,-1), time);
+        check(tree.hit(r, interval(0.001, infinity), rec) && std::fabs(rec.t - 4) < 1e-9,
+              "motion_bvh hits a one-knot moving sphere at its offset");
+    }
+}
+
+static void test_motion_segments_capped() {
+    // Coprime path lengths would overflow an int's least common multiple.
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    hittable_list world;
+    for (int knots : {1000, 1001, 1002, 1003, 1004})
+        world.add(make_shared<moving>(make_shared<sphere>(point3(0,0,0), 1.0, mat),
+                                      std::vector<vec3>(knots, vec3(0,0,0))));
+    auto segments = world.motion_segments();
+    check(segments > 0, "motion segments of many coprime paths stay positive");
+}
+
+static void test_mipmap_odd_sizes() {
+    // A 5x3 image lit only in its last column, which an odd width leaves over from the 2x2
+    // blocks. The 2x1 level's second texel takes it in over 3 columns, at 1/3, so the top
+    // texel comes to 1/6; dropping the column would leave it black.
+    auto path = (std::filesystem::temp_directory_path() / "rt_test_mipmap.ppm").string();
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << "P6\n5 3\n255\n";
+        for (int j = 0; j < 3; j++)
+            for (int i = 0; i < 5; i++)
+                for (int c = 0; c < 3; c++)
+                    file.put(char(i == 4 ? 255 : 0));
+    }
+
+    rtw_image image(path.c_str(), false);
+    std::remove(path.c_str());
+    mipmap pyramid(image);
+
+    texture_footprint whole_image;
+    whole_image.dudx = whole_image.dvdy = 1;
+    auto top = pyramid.filtered(0.5, 0.5, whole_image);
+    check(pyramid.level_count() == 3 && std::fabs(top.x() - 1.0/6) < 0.01,
+          "mipmap of an odd-sized image averages its last column into the top level");
+}
+
+static void test_light_tree_pdf() {
+    // A grid of small panels facing +z and glowing spheres on the ground before them, as in
+    // led_wall_scene.
+    seed_random(41);
+    hittable_list lights;
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 6; i++)
+            lights.add(make_shared<quad>(point3(-3 + i, 0.5 + j, -4), vec3(0.6,0,0), vec3(0,0.6,0),
+                                         make_shared<diffuse_light>(random_double(2, 10) * color(1,1,1))));
+    for (int k = 0; k < 12; k++)
+        lights.add(make_shared<sphere>(point3(random_double(-4, 4), 0.2, random_double(-3, 3)), 0.2,
+                                       make_shared<diffuse_light>(random_double(20, 60) * color(1,1,1))));
+    light_tree tree(lights);
+
+    // In front of the panels, beside them just off their plane, and behind them, outside every
+    // panel's emission cone.
+    // Uniform directions mostly miss the lights, so the integral takes more of them.
+    const int n = 400000;
+    for (auto origin : {point3(0,1.5,2), point3(5,1,-3.8), point3(0,1.5,-6)}) {
+        check(std::fabs(integrated_pdf(tree, origin, 4 * n) - 1) < 0.05,
+              "light_tree pdf integrates to 1 over the sphere");
+
+        // Only lights the tree can pick count toward the solid angle its samples cover.
+        hittable_list pickable;
+        for (size_t i = 0; i < lights.objects.size(); i++)
+            if (tree.light_probability(origin, i) > 0)
+                pickable.add(lights.objects[i]);
+        check(std::fabs(mean_inverse_pdf(tree, origin, n) / solid_angle(pickable, origin, n) - 1) < 0.05,
+              "light_tree mean 1/pdf matches the solid angle of its lights");
+    }
+
+    // Far enough behind that no group of panels' bounds reaches around to face the point,
+    // the spheres take every sample.
+    double behind = 0;
+    for (size_t i = 0; i < 24; i++)
+        behind += tree.light_probability(point3(0,1.5,-30), i);
+    check(behind == 0, "light_tree never picks a panel from well behind it");
+}
+
+static void test_triangle_sampling_pdf() {
+    // Close up and edge-on the triangle is sampled over its spherical projection (Arvo's
+    // method); from far away, by area. Either way the pdf covers its solid angle once.
+    seed_random(42);
+    auto light = make_shared<diffuse_light>(color(4,4,4));
+    triangle tri(point3(-1,0,-1), point3(1,0,-1), point3(0,2,-1), light);
+
+    // Edge-on, the triangle fills a small part of the cone around its bounds, so it takes more
+    // directions to hit it often enough.
+    const int n = 1600000;
+    for (auto origin : {point3(0,0.6,-0.7), point3(4,0.5,-0.95), point3(0,0.6,40), point3(0,0.6,200)}) {
+        check(std::fabs(integrated_pdf(tri, origin, n) - 1) < 0.05,
+              "triangle pdf integrates to 1 over the sphere");
+        check(std::fabs(mean_inverse_pdf(tri, origin, n) / solid_angle(tri, origin, n) - 1) < 0.05,
+              "triangle mean 1/pdf matches its solid angle");
+    }
+}
+
+static void test_mesh_sampling_pdf() {
+    // A unit square of two triangles and a third triangle off to its side, tilted away.
+    auto path = (std::filesystem::temp_directory_path() / "rt_test_mesh.obj").string();
+    {
+        std::ofstream file(path);
+        file << "v -0.5 0 0\nv 0.5 0 0\nv 0.5 1 0\nv -0.5 1 0\n"
+                "v 2 0 0\nv 2 1 0\nv 2.5 0.5 -1\n"
+                "f 1 2 3\nf 1 3 4\nf 5 6 7\n";
+    }
+    mesh glowing(path, make_shared<diffuse_light>(color(4,4,4)));
+    std::remove(path.c_str());
+    check(glowing.faces().size() == 3, "mesh loads its three faces");
+
+    seed_random(43);
+    const int n = 400000;
+    for (auto origin : {point3(0,0.5,1.5), point3(0.5,0.5,60)}) {
+        check(std::fabs(integrated_pdf(glowing, origin, n) - 1) < 0.03,
+              "mesh pdf integrates to 1 over the sphere");
+        check(std::fabs(mean_inverse_pdf(glowing, origin, n) / solid_angle(glowing, origin, n) - 1) < 0.03,
+              "mesh mean 1/pdf matches its solid angle");
+    }
+}
+
+static void test_environment_pdf() {
+    // The sky's pdf is constant over each pixel and peaks sharply at the sun, so both integrals
+    // are summed pixel by pixel over their exact solid angles rather than estimated from
+    // uniform directions: the pdf's should come to 1, and the luminance's is the power that
+    // the mean of L/pdf over the light's own samples should reach.
+    environment_light sky("sky.hdr");
+    rtw_image image("sky.hdr", false);
+    int w = image.width(), h = image.height();
+    check(w > 0 && h > 0, "sky.hdr loads");
+
+    point3 origin(0,0,0);
+    double pdf_integral = 0, power = 0;
+    for (int j = 0; j < h; j++) {
+        // The top row looks straight up, at theta = pi, as in environment_light.
+        auto theta = pi * (1 - (j + 0.5) / h);
+        auto pixel_solid_angle =
+            2*pi / w * std::fabs(std::cos(pi * (1 - double(j) / h)) - std::cos(pi * (1 - double(j + 1) / h)));
+        for (int i = 0; i < w; i++) {
+            auto phi = 2*pi * (i + 0.5) / w - pi;
+            vec3 d(std::sin(theta) * std::cos(phi), -std::cos(theta), -std::sin(theta) * std::sin(phi));
+            pdf_integral += sky.pdf_value(origin, d) * pixel_solid_angle;
+            power += luminance(sky.value(d)) * pixel_solid_angle;
+        }
+    }
+    check(std::fabs(pdf_integral - 1) < 0.01, "environment pdf integrates to 1 over the sphere");
+
+    seed_random(44);
+    const int n = 400000;
+    double sum = 0;
+    for (int k = 0; k < n; k++) {
+        auto d = sky.random(origin);
+        sum += luminance(sky.value(d)) / sky.pdf_value(origin, d);
+    }
+    check(std::fabs(sum / n / power - 1) < 0.01, "environment mean L/pdf matches its power");
+
+    // With no other lights, empty lists and samplers alike, the environment takes every sample.
+    hittable_list no_lights;
+    light_sampler no_sampled_lights(no_lights);
+    for (const hittable* lights : std::initializer_list<const hittable*>{&no_lights, &no_sampled_lights}) {
+        environment_and_lights both(sky, *lights);
+        auto d = sky.random(origin);
+        check(both.pdf_value(origin, d) == sky.pdf_value(origin, d),
+              "environment takes every sample when there are no other lights");
+    }
+}
+
+int main() {
+    test_one_knot_moving();
+    test_motion_segments_capped();
+    test_mipmap_odd_sizes();
+    test_light_tree_pdf();
+    test_triangle_sampling_pdf();
+    test_mesh_sampling_pdf();
+    test_environment_pdf();
+
+    if (failures == 0)
+        std::cout << "All tests passed.\n";
+    return failures;
+}